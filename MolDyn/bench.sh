@@ -0,0 +1,6 @@
+#!/usr/bin/env bash
+
+icpc -std=c++17 -qopenmp -Wall -O3 -I ./inc ./src/bench.cpp -o ./bin/bench
+
+# Up to 10^6 particles, 1 s per case; JSON results kept per machine/compiler
+./bin/bench 1e6 1 > bench_$(hostname)_$(date +%Y%m%d).json
@@ -0,0 +1,6 @@
+#!/usr/bin/env bash
+
+icpc -std=c++17 -qopenmp -Wall -O3 -I ./inc ./src/ensemble.cpp -o ./bin/ensemble
+
+# One line per replica every 1000 steps in ensemble.dat
+./bin/ensemble
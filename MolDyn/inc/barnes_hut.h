@@ -0,0 +1,509 @@
+#pragma once
+
+#include <cstdint>
+
+#include "moldyn.h"
+
+/*    Barnes-Hut model    */
+
+// Coulomb (or, with a negative constant and masses as charges, gravity)
+// interaction of signed charges without boundaries, through a Barnes-Hut
+// tree: a 2^dim-ary tree of cubic cells (quadtree in 2D, octree in 3D).
+// A cell seen from a particle under an angle size / distance below theta
+// acts through its multipole expansion: total charge and dipole moment about
+// the centre of absolute charge (the dipole term keeps cells of mixed signs
+// accurate). Closer cells are opened; leaves are summed directly.
+// Build: particles are sorted by Morton key of their cell at the finest
+// level, so every cell is a contiguous range. The top levels are built
+// serially, the subtrees below in parallel. Traversal is parallel over
+// particles, each writing only its own force.
+// The model has no range for NewtonSys pair rows: the whole interaction goes
+// through long_range(). Pair functions give the direct (softened) term for
+// unit charges.
+// Tree forces do not cancel exactly in pairs, so the virial sum of x F
+// would depend on the origin: positions are taken about their centroid,
+// which makes it translation invariant (and exact for exact forces). The
+// pressure is still only as accurate as the tree forces.
+
+// Tree cell
+struct BH_Node {
+  // Expansion centre, dipole moment
+  double center[3], dipole[3];
+  // Total charge, total absolute charge, cell size
+  double q, abs_q, size;
+  // Particles of the cell (range of the sorted order)
+  uint32_t first, count;
+  // Children, contiguous (none for leaves)
+  uint32_t child, n_children;
+};
+
+class Barnes_Hut {
+
+  // Charges of the particles
+  std::vector<double> _charge;
+  // Opening angle, Coulomb constant, softening length squared
+  double _theta, _k_e, _eps2;
+  // Particles per leaf
+  size_t _leaf_size;
+
+  // Tree and particles in Morton order
+  std::vector<BH_Node> _nodes;
+  std::vector<uint64_t> _keys;
+  std::vector<uint32_t> _order;
+  // Sorted positions (component rows of n) and charges
+  std::vector<double> _x, _q;
+  // Potential and force of each particle (sorted order)
+  std::vector<double> _phi, _force;
+  // Subtrees below the serial top levels
+  std::vector<std::vector<BH_Node>> _subtrees;
+  // Build buffers, kept between evaluations: sort chunk bounds, sorted keys,
+  // leaves of the serial top levels
+  std::vector<size_t> _cut;
+  std::vector<uint64_t> _sorted;
+  std::vector<size_t> _frontier;
+
+  // Build the cell for a range of sorted particles and its descendants
+  void _build(std::vector<BH_Node> &, size_t, size_t, size_t, size_t, size_t,
+              const double *, double, bool);
+  // Multipoles of a cell from its children or particles
+  void _moments(BH_Node &, const BH_Node *, size_t);
+  // Potential and force on sorted particle j
+  void _field(size_t, size_t, double &, double *) const;
+
+public:
+  // Name
+  static const std::string name;
+  // Constructor
+  // IN: charges of the particles, opening angle, Coulomb constant,
+  // softening length
+  Barnes_Hut(const std::vector<double> &, double = 0.5, double = 1,
+             double = 0);
+  // Set parameters
+  void set_charges(const std::vector<double> &);
+  void set_theta(double theta) { _theta = theta; }
+  void set_leaf_size(size_t n) { _leaf_size = n ? n : 1; }
+  // Getters
+  double charge(size_t j) const { return _charge[j]; }
+  size_t n_nodes(void) const { return _nodes.size(); }
+  // No range for pair rows: everything is long range
+  double cutoff(void) const { return 0; }
+  // Potential energy (direct, unit charges)
+  double potential(double) const;
+  double potential(const double *, size_t) const;
+  double potential(const Particle &, const Particle &) const;
+  // Force (direct, unit charges)
+  double k_force(double) const;
+  void force(const double *, size_t, double *) const;
+  void force(const Particle &, const Particle &, double *) const;
+  // Force multiplier and potential energy (direct, unit charges)
+  double pair(double, double &) const;
+  // Tree forces on n particles
+  // OUT: potential energy
+  double tree(const Pair_Data &, size_t);
+};
+
+// Tree forces for Barnes-Hut models
+template <size_t Dim>
+double long_range(Barnes_Hut &, const Pair_Data &, size_t);
+
+// Charges follow the particles when their storage is reordered
+void reorder_model(Barnes_Hut &, const size_t *, size_t);
+
+// Double precision only (tree work on double pair data)
+template <> struct Reduced_Precision<Barnes_Hut> : std::false_type {};
+
+// Barnes-Hut model
+
+/*    Barnes-Hut model    */
+
+// Name
+const std::string Barnes_Hut::name = "Coulomb (Barnes-Hut tree)";
+
+// Constructor
+Barnes_Hut::Barnes_Hut(const std::vector<double> &charge, double theta,
+                       double k_e, double softening)
+    : _charge(charge), _theta(theta), _k_e(k_e),
+      _eps2(softening * softening), _leaf_size(8) {}
+
+// Set charges
+void Barnes_Hut::set_charges(const std::vector<double> &charge) {
+  _charge = charge;
+}
+
+// Potential energy (direct, unit charges)
+double Barnes_Hut::potential(double d2) const {
+  return _k_e / std::sqrt(d2 + _eps2);
+}
+double Barnes_Hut::potential(const double *s, size_t dim) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  return potential(d2);
+}
+double Barnes_Hut::potential(const Particle &part1,
+                             const Particle &part2) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  return potential(d2);
+}
+
+// Force (direct, unit charges)
+double Barnes_Hut::k_force(double d2) const {
+  double k;
+  pair(d2, k);
+  return k;
+}
+void Barnes_Hut::force(const double *s, size_t dim, double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  double k = k_force(d2);
+  for (size_t i = 0; i < dim; i++)
+    F[i] = k * s[i];
+}
+void Barnes_Hut::force(const Particle &part1, const Particle &part2,
+                       double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  double k = k_force(d2);
+  for (size_t i = 0; i < part1.dim; i++)
+    F[i] = k * (part1.x[i] - part2.x[i]);
+}
+
+// Force multiplier and potential energy (direct, unit charges)
+double Barnes_Hut::pair(double d2, double &k) const {
+  const double inv2 = 1 / (d2 + _eps2), E = _k_e * std::sqrt(inv2);
+  k = E * inv2;
+  return E;
+}
+
+// Multipoles of a cell from its children (or its particles for a leaf)
+void Barnes_Hut::_moments(BH_Node &c, const BH_Node *nodes, size_t dim) {
+  size_t i, j;
+  double center[3] = {0, 0, 0};
+  c.q = c.abs_q = 0;
+  // Centre of absolute charge (geometric centre if there is no charge)
+  if (c.n_children)
+    for (j = c.child; j < c.child + c.n_children; j++) {
+      c.q += nodes[j].q;
+      c.abs_q += nodes[j].abs_q;
+      for (i = 0; i < dim; i++)
+        center[i] += nodes[j].abs_q * nodes[j].center[i];
+    }
+  else
+    for (j = c.first; j < c.first + c.count; j++) {
+      c.q += _q[j];
+      c.abs_q += std::fabs(_q[j]);
+      for (i = 0; i < dim; i++)
+        center[i] += std::fabs(_q[j]) * _x[i * _q.size() + j];
+    }
+  if (c.abs_q > 0)
+    for (i = 0; i < dim; i++)
+      c.center[i] = center[i] / c.abs_q;
+  // Dipole about the centre
+  for (i = 0; i < dim; i++) {
+    c.dipole[i] = 0;
+    if (c.n_children)
+      for (j = c.child; j < c.child + c.n_children; j++)
+        c.dipole[i] +=
+            nodes[j].dipole[i] + nodes[j].q * (nodes[j].center[i] - c.center[i]);
+    else
+      for (j = c.first; j < c.first + c.count; j++)
+        c.dipole[i] += _q[j] * (_x[i * _q.size() + j] - c.center[i]);
+  }
+}
+
+// Build the cell at a level for sorted particles [b, e), and (unless only
+// the top levels are wanted) its descendants. Cells at the serial depth are
+// left as leaves to be replaced by subtrees.
+void Barnes_Hut::_build(std::vector<BH_Node> &nodes, size_t c, size_t b,
+                        size_t e, size_t level, size_t dim,
+                        const double *corner, double size, bool top) {
+  size_t i, j;
+  const size_t bits = 63 / dim, n_child = size_t(1) << dim;
+  BH_Node &node = nodes[c];
+  node.first = b;
+  node.count = e - b;
+  node.size = size;
+  node.n_children = 0;
+  // Geometric centre until the moments are known
+  for (i = 0; i < 3; i++) {
+    node.center[i] = i < dim ? corner[i] + 0.5 * size : 0;
+    node.dipole[i] = 0;
+  }
+  const size_t serial_depth = dim == 3 ? 2 : (dim == 2 ? 3 : 6);
+  if (e - b <= _leaf_size || level == bits || (top && level == serial_depth)) {
+    if (!top)
+      _moments(nodes[c], nodes.data(), dim);
+    return;
+  }
+
+  // Children: ranges of equal digit at this level
+  const size_t shift = dim * (bits - 1 - level);
+  size_t bounds[9], k = b;
+  for (j = 0; j < n_child; j++) {
+    bounds[j] = k;
+    while (k < e && ((_keys[k] >> shift) & (n_child - 1)) == j)
+      k++;
+  }
+  bounds[n_child] = e;
+  size_t n_nonempty = 0;
+  for (j = 0; j < n_child; j++)
+    n_nonempty += bounds[j + 1] > bounds[j];
+  const size_t first_child = nodes.size();
+  nodes[c].child = first_child;
+  nodes[c].n_children = n_nonempty;
+  nodes.resize(first_child + n_nonempty);
+  for (j = 0, k = first_child; j < n_child; j++) {
+    if (bounds[j + 1] == bounds[j])
+      continue;
+    // Digit bits: dimension i is bit dim - 1 - i
+    double child_corner[3];
+    for (i = 0; i < dim; i++)
+      child_corner[i] = corner[i] + ((j >> (dim - 1 - i)) & 1) * 0.5 * size;
+    _build(nodes, k++, bounds[j], bounds[j + 1], level + 1, dim, child_corner,
+           0.5 * size, top);
+  }
+  if (!top)
+    _moments(nodes[c], nodes.data(), dim);
+}
+
+// Potential and force (per unit charge of j) on sorted particle j
+void Barnes_Hut::_field(size_t j, size_t dim, double &phi, double *E) const {
+  size_t i, k;
+  const size_t n = _q.size();
+  double r[3] = {0, 0, 0};
+  for (i = 0; i < dim; i++)
+    r[i] = _x[i * n + j];
+  phi = 0;
+  for (i = 0; i < dim; i++)
+    E[i] = 0;
+
+  // Depth-first walk with an explicit stack
+  uint32_t stack[64 * 8];
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top) {
+    const BH_Node &c = _nodes[stack[--top]];
+    double s[3], d2 = 0;
+    for (i = 0; i < dim; i++) {
+      s[i] = r[i] - c.center[i];
+      d2 += s[i] * s[i];
+    }
+    const bool inside = j >= c.first && j < c.first + c.count;
+    if (!inside && c.size * c.size < _theta * _theta * d2) {
+      // Far: monopole and dipole
+      const double inv2 = 1 / (d2 + _eps2), inv = std::sqrt(inv2),
+                   inv3 = inv * inv2;
+      double ps = 0;
+      for (i = 0; i < dim; i++)
+        ps += c.dipole[i] * s[i];
+      phi += c.q * inv + ps * inv3;
+      for (i = 0; i < dim; i++)
+        E[i] += c.q * inv3 * s[i] + 3 * ps * inv3 * inv2 * s[i] -
+                c.dipole[i] * inv3;
+    } else if (c.n_children)
+      for (k = 0; k < c.n_children; k++)
+        stack[top++] = c.child + k;
+    else
+      // Leaf: direct sum
+      for (k = c.first; k < c.first + c.count; k++) {
+        if (k == j)
+          continue;
+        double t[3], t2 = _eps2;
+        for (i = 0; i < dim; i++) {
+          t[i] = r[i] - _x[i * n + k];
+          t2 += t[i] * t[i];
+        }
+        const double inv2 = 1 / t2, inv = std::sqrt(inv2);
+        phi += _q[k] * inv;
+        for (i = 0; i < dim; i++)
+          E[i] += _q[k] * inv * inv2 * t[i];
+      }
+  }
+}
+
+// Tree forces on n particles
+double Barnes_Hut::tree(const Pair_Data &d, size_t n) {
+
+  // Dummy indices
+  size_t i, j, f;
+
+  const size_t dim = d.dim, stride = d.stride;
+  try {
+    if (dim > 3 || _charge.size() != n || n >= (size_t(1) << 32))
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: Barnes-Hut tree needs at most 3 dimensions and one "
+                 "charge per particle"
+              << '\n';
+    return 0;
+  }
+  if (n == 0)
+    return 0;
+
+  // Bounding cube
+  double lo[3], hi[3];
+  for (i = 0; i < dim; i++) {
+    lo[i] = hi[i] = d.x[i * stride];
+    for (j = 1; j < n; j++) {
+      lo[i] = std::min(lo[i], d.x[i * stride + j]);
+      hi[i] = std::max(hi[i], d.x[i * stride + j]);
+    }
+  }
+  double size = 0;
+  for (i = 0; i < dim; i++)
+    size = std::max(size, hi[i] - lo[i]);
+  size = size > 0 ? size * (1 + 1e-12) : 1;
+
+  // Morton keys: bits of the cell at the finest level, interleaved
+  const size_t bits = 63 / dim;
+  const double scale = double(uint64_t(1) << bits) / size;
+  _keys.resize(n);
+  _order.resize(n);
+#pragma omp parallel for private(i) schedule(static)
+  for (long jl = 0; jl < long(n); jl++) {
+    uint64_t key = 0, cell[3];
+    for (i = 0; i < dim; i++) {
+      double u = (d.x[i * stride + jl] - lo[i]) * scale;
+      cell[i] = std::min(uint64_t(u), (uint64_t(1) << bits) - 1);
+    }
+    for (size_t l = bits; l-- > 0;)
+      for (i = 0; i < dim; i++)
+        key = (key << 1) | ((cell[i] >> l) & 1);
+    _keys[jl] = key;
+    _order[jl] = uint32_t(jl);
+  }
+
+  // Sort by key: chunks in parallel, then merged
+  const int n_chunks = max_threads();
+  std::vector<size_t> &cut = _cut;
+  cut.resize(n_chunks + 1);
+  for (int c = 0; c <= n_chunks; c++)
+    cut[c] = n * c / n_chunks;
+  auto by_key = [this](uint32_t a, uint32_t b) {
+    return _keys[a] < _keys[b] || (_keys[a] == _keys[b] && a < b);
+  };
+#pragma omp parallel for schedule(static, 1)
+  for (int c = 0; c < n_chunks; c++)
+    std::sort(_order.begin() + cut[c], _order.begin() + cut[c + 1], by_key);
+  for (int width = 1; width < n_chunks; width *= 2) {
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < n_chunks - width; c += 2 * width)
+      std::inplace_merge(_order.begin() + cut[c], _order.begin() + cut[c + width],
+                         _order.begin() + cut[std::min(c + 2 * width, n_chunks)],
+                         by_key);
+  }
+
+  // Sorted keys, positions and charges
+  std::vector<uint64_t> &keys = _keys;
+  _x.resize(dim * n);
+  _q.resize(n);
+  _sorted.resize(n);
+  for (j = 0; j < n; j++) {
+    const size_t o = _order[j];
+    _sorted[j] = keys[o];
+    _q[j] = _charge[o];
+    for (i = 0; i < dim; i++)
+      _x[i * n + j] = d.x[i * stride + o];
+  }
+  keys.swap(_sorted);
+
+  // Top levels, serially
+  _nodes.assign(1, BH_Node());
+  _build(_nodes, 0, 0, n, 0, dim, lo, size, true);
+  const size_t n_top = _nodes.size();
+  std::vector<size_t> &frontier = _frontier;
+  frontier.clear();
+  for (f = 0; f < n_top; f++)
+    if (_nodes[f].n_children == 0)
+      frontier.push_back(f);
+
+  // Subtrees, in parallel
+  _subtrees.resize(frontier.size());
+#pragma omp parallel for schedule(dynamic, 1)
+  for (long fl = 0; fl < long(frontier.size()); fl++) {
+    const BH_Node &root = _nodes[frontier[fl]];
+    std::vector<BH_Node> &sub = _subtrees[fl];
+    sub.assign(1, BH_Node());
+    // Level of the root from its size
+    size_t level = 0;
+    for (double s = size; s > root.size * 1.5; s *= 0.5)
+      level++;
+    double corner[3];
+    for (i = 0; i < dim; i++)
+      corner[i] = root.center[i] - 0.5 * root.size;
+    _build(sub, 0, root.first, root.first + root.count, level, dim, corner,
+           root.size, false);
+  }
+
+  // Splice subtrees: the root replaces the frontier cell, the rest is
+  // appended with shifted child indices
+  for (f = 0; f < frontier.size(); f++) {
+    const std::vector<BH_Node> &sub = _subtrees[f];
+    const size_t base = _nodes.size();
+    _nodes[frontier[f]] = sub[0];
+    if (sub[0].n_children)
+      _nodes[frontier[f]].child = sub[0].child + base - 1;
+    for (j = 1; j < sub.size(); j++) {
+      _nodes.push_back(sub[j]);
+      if (sub[j].n_children)
+        _nodes.back().child += base - 1;
+    }
+  }
+
+  // Moments of the top cells, children (higher indices) first
+  for (f = n_top; f-- > 0;)
+    if (_nodes[f].n_children)
+      _moments(_nodes[f], _nodes.data(), dim);
+
+  // Fields, in parallel over particles
+  _phi.resize(n);
+  _force.resize(dim * n);
+#pragma omp parallel for private(i) schedule(dynamic, 64)
+  for (long jl = 0; jl < long(n); jl++) {
+    double phi, E[3];
+    _field(jl, dim, phi, E);
+    _phi[jl] = _k_e * _q[jl] * phi;
+    for (i = 0; i < dim; i++)
+      _force[i * n + jl] = _k_e * _q[jl] * E[i];
+  }
+
+  // Accelerations, energy and virial (positions about their centroid)
+  double E_p = 0, centroid[3] = {0, 0, 0};
+  for (i = 0; i < dim; i++) {
+    for (j = 0; j < n; j++)
+      centroid[i] += _x[i * n + j];
+    centroid[i] /= n;
+  }
+  for (j = 0; j < n; j++) {
+    const size_t o = _order[j];
+    E_p += 0.5 * _phi[j];
+    for (i = 0; i < dim; i++) {
+      const double F = _force[i * n + j];
+      d.acc[i * stride + o] += F * d.scale;
+      for (size_t b = 0; b < dim; b++)
+        d.virial[b * dim + i] +=
+            (_x[b * n + j] - centroid[b]) * F * d.scale;
+    }
+  }
+  return E_p;
+}
+
+// Tree forces for Barnes-Hut models
+template <size_t Dim>
+double long_range(Barnes_Hut &model, const Pair_Data &d, size_t n) {
+  return model.tree(d, n);
+}
+
+// Charges follow the particles
+void reorder_model(Barnes_Hut &model, const size_t *order, size_t n) {
+  std::vector<double> charge(n);
+  for (size_t j = 0; j < n; j++)
+    charge[j] = model.charge(order[j]);
+  model.set_charges(charge);
+}
+
+// Barnes-Hut model
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*    Checkpoints   */
+
+// Binary snapshot of the whole state of a system, to restart a run exactly
+// where it stopped. A file is a header followed by blocks, each a byte count
+// and its payload padded to 8 bytes, in an order fixed by the system that
+// wrote it (and checked by the version number). The header also records the
+// size of the stored reals and an id of the interaction model, so a state is
+// never read back into a system of another precision or model.
+// Files are written to a temporary name, synced and renamed over the old
+// checkpoint: a crash while writing leaves the previous one intact.
+// Restoring maps the file and copies the blocks straight into place.
+
+const uint64_t CKPT_MAGIC = 0x54504b434459444dULL;
+const uint32_t CKPT_VERSION = 3;
+
+// Kind of system
+enum Ckpt_Kind : uint32_t { ckpt_newton = 1, ckpt_pendulum = 2 };
+
+struct Ckpt_Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t kind;
+  // Number of dimensions and of particles (or links)
+  uint64_t dim;
+  uint64_t n;
+  // Bytes in the file, header included
+  uint64_t bytes;
+  // Bytes per stored real and id of the model (0 if the system has none)
+  uint64_t real_size;
+  uint64_t model;
+  uint64_t reserved[1];
+};
+
+// Checkpoints
+
+/*    Checkpoint writer   */
+
+class Ckpt_Writer {
+
+  std::vector<char> _data;
+
+public:
+  // Constructor
+  // IN: kind of system, number of dimensions, number of particles, bytes per
+  // real, model id
+  Ckpt_Writer(Ckpt_Kind, uint64_t, uint64_t, uint64_t = sizeof(double),
+              uint64_t = 0);
+
+  // Append a block
+  void add(const void *, size_t);
+  template <typename T> void add(const T &value) { add(&value, sizeof(T)); }
+  void add(const std::string &s) { add(s.data(), s.size()); }
+
+  // Write the file atomically
+  // OUT: false on failure (the previous file is left as it was)
+  bool write(const std::string &);
+};
+
+// Checkpoint writer
+
+/*    Checkpoint reader   */
+
+class Ckpt_Reader {
+
+  char *_map;
+  size_t _length;
+  // Next block
+  size_t _offset;
+
+public:
+  // Constructor
+  // IN: file name, kind of system, bytes per real and model id expected
+  Ckpt_Reader(const std::string &, Ckpt_Kind, uint64_t = sizeof(double),
+              uint64_t = 0);
+  ~Ckpt_Reader(void);
+
+  Ckpt_Reader(const Ckpt_Reader &) = delete;
+  Ckpt_Reader &operator=(const Ckpt_Reader &) = delete;
+
+  // Getters
+  bool valid(void) const { return _map != nullptr; }
+  const Ckpt_Header &header(void) const {
+    return *reinterpret_cast<const Ckpt_Header *>(_map);
+  }
+
+  // Next block
+  // OUT: its payload (null past the end), its size in bytes
+  const char *block(size_t &);
+  // Copy the next block, which must be exactly that many bytes
+  bool get(void *, size_t);
+  template <typename T> bool get(T &value) { return get(&value, sizeof(T)); }
+  bool get(std::string &);
+};
+
+// Checkpoint reader
+
+/*    Checkpoint schedule   */
+
+// Checkpoints every n calls of step() and when the process is asked to stop
+// (SIGTERM, as on preemption): then the caller is told to finish.
+class Checkpointer {
+
+  std::string _name;
+  size_t _every, _count;
+  // Set by the signal handler
+  inline static volatile std::sig_atomic_t _terminate = 0;
+
+  static void _handler(int) { _terminate = 1; }
+
+public:
+  // Constructor
+  // IN: file name, calls between checkpoints (0: only on SIGTERM)
+  Checkpointer(const std::string &, size_t);
+
+  // Stop requested
+  bool terminated(void) const { return _terminate != 0; }
+
+  // Call after each step (or batch of steps) of a system with
+  // checkpoint(name)
+  // OUT: true once stopped by SIGTERM (checkpoint written): finish the run
+  template <typename System> bool step(System &);
+};
+
+// Checkpoint schedule
+
+/*    Checkpoint writer   */
+
+// Constructor
+Ckpt_Writer::Ckpt_Writer(Ckpt_Kind kind, uint64_t dim, uint64_t n,
+                         uint64_t real_size, uint64_t model)
+    : _data(sizeof(Ckpt_Header), 0) {
+  Ckpt_Header *header = reinterpret_cast<Ckpt_Header *>(_data.data());
+  header->magic = CKPT_MAGIC;
+  header->version = CKPT_VERSION;
+  header->kind = kind;
+  header->dim = dim;
+  header->n = n;
+  header->real_size = real_size;
+  header->model = model;
+}
+
+// Append a block
+void Ckpt_Writer::add(const void *data, size_t bytes) {
+  const uint64_t size = bytes;
+  const size_t at = _data.size(), padded = (bytes + 7) / 8 * 8;
+  _data.resize(at + sizeof(size) + padded, 0);
+  std::memcpy(_data.data() + at, &size, sizeof(size));
+  if (bytes)
+    std::memcpy(_data.data() + at + sizeof(size), data, bytes);
+}
+
+// Write the file atomically
+bool Ckpt_Writer::write(const std::string &name) {
+  reinterpret_cast<Ckpt_Header *>(_data.data())->bytes = _data.size();
+  const std::string temp = name + ".tmp";
+  int fd = -1;
+  try {
+    fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw 0;
+    size_t done = 0;
+    while (done < _data.size()) {
+      const ssize_t w = ::write(fd, _data.data() + done, _data.size() - done);
+      if (w <= 0)
+        throw 0;
+      done += size_t(w);
+    }
+    if (fsync(fd) != 0)
+      throw 0;
+    ::close(fd);
+    fd = -1;
+    if (std::rename(temp.c_str(), name.c_str()) != 0)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot write checkpoint " << name << '\n';
+    if (fd >= 0)
+      ::close(fd);
+    ::unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Checkpoint writer
+
+/*    Checkpoint reader   */
+
+// Constructor
+Ckpt_Reader::Ckpt_Reader(const std::string &name, Ckpt_Kind kind,
+                         uint64_t real_size, uint64_t model)
+    : _map(nullptr), _length(0), _offset(sizeof(Ckpt_Header)) {
+  int fd = -1;
+  void *map = MAP_FAILED;
+  try {
+    fd = ::open(name.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        size_t(st.st_size) < sizeof(Ckpt_Header))
+      throw 0;
+    _length = st.st_size;
+    map = mmap(nullptr, _length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+      throw 0;
+    const Ckpt_Header *header = static_cast<const Ckpt_Header *>(map);
+    if (header->magic != CKPT_MAGIC || header->version != CKPT_VERSION ||
+        header->kind != kind || header->bytes != _length ||
+        header->real_size != real_size || header->model != model)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: invalid checkpoint " << name << '\n';
+    if (map != MAP_FAILED)
+      munmap(map, _length);
+    if (fd >= 0)
+      ::close(fd);
+    return;
+  }
+  ::close(fd);
+  madvise(map, _length, MADV_SEQUENTIAL);
+  _map = static_cast<char *>(map);
+}
+
+Ckpt_Reader::~Ckpt_Reader(void) {
+  if (_map)
+    munmap(_map, _length);
+}
+
+// Next block
+const char *Ckpt_Reader::block(size_t &bytes) {
+  uint64_t size;
+  bytes = 0;
+  if (!_map || _offset + sizeof(size) > _length)
+    return nullptr;
+  std::memcpy(&size, _map + _offset, sizeof(size));
+  const size_t padded = (size + 7) / 8 * 8;
+  if (_offset + sizeof(size) + padded > _length)
+    return nullptr;
+  const char *data = _map + _offset + sizeof(size);
+  _offset += sizeof(size) + padded;
+  bytes = size;
+  return data;
+}
+
+// Copy the next block
+bool Ckpt_Reader::get(void *value, size_t bytes) {
+  size_t size;
+  const char *data = block(size);
+  if (!data || size != bytes)
+    return false;
+  std::memcpy(value, data, bytes);
+  return true;
+}
+
+bool Ckpt_Reader::get(std::string &s) {
+  size_t size;
+  const char *data = block(size);
+  if (!data)
+    return false;
+  s.assign(data, size);
+  return true;
+}
+
+// Checkpoint reader
+
+/*    Checkpoint schedule   */
+
+// Constructor
+Checkpointer::Checkpointer(const std::string &name, size_t every)
+    : _name(name), _every(every), _count(0) {
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = _handler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGTERM, &action, nullptr);
+}
+
+// Call after each step
+template <typename System> bool Checkpointer::step(System &sys) {
+  _count++;
+  if (_terminate) {
+    sys.checkpoint(_name);
+    return true;
+  }
+  if (_every && _count % _every == 0)
+    sys.checkpoint(_name);
+  return false;
+}
+
+// Checkpoint schedule
@@ -0,0 +1,659 @@
+#pragma once
+
+#include <cstdint>
+
+#include <mpi.h>
+
+#include "moldyn.h"
+
+/*    Domain decomposition    */
+
+// Distributed Newtonian system: the container is split into a grid of
+// boxes, one per MPI rank, and each rank only stores the particles in its
+// box (memory scales with the number of ranks).
+// Every step, particles that left a box move to the neighbouring rank
+// (migration), then each rank receives copies of the particles of its
+// neighbours within one cutoff of its box (ghosts), forwarded one dimension
+// at a time so that edge and corner neighbours are covered. Pairs between an
+// own particle and a ghost are evaluated on both ranks: each keeps the force
+// on its own particle and half of the energy and virial.
+// Boxes must be at least one cutoff wide. Pair models only: long_range() is
+// not called. Walls and periodic boundaries (unbounded is run as walls).
+// MPI must be initialized by the caller; energies, pressure and gather are
+// collective (every rank calls them).
+
+// Model: interaction model
+// Dim: number of dimensions fixed at compile time, 0 to choose at run time
+template <typename Model, size_t Dim = 0> class Domain_Sys {
+
+private:
+  // Number of dimensions
+  const size_t _dim;
+  // Size of container
+  std::vector<double> _size;
+  // Universal time
+  double _time;
+  // Number of particles in the whole system
+  const size_t _n_particles;
+  // Mass of each particle
+  double _mass;
+  // Boundary conditions
+  Bound _bound;
+  // Interaction range
+  double _cutoff;
+
+  // Cartesian communicator, rank and number of ranks
+  MPI_Comm _comm;
+  int _rank, _n_ranks;
+  // Ranks along each dimension, coordinates of this rank, neighbours below
+  // and above (MPI_PROC_NULL at walls)
+  std::vector<int> _ranks, _coords, _below, _above;
+  // Box of this rank
+  std::vector<double> _lo, _hi;
+
+  // Own particles, one record each: position, velocity, acceleration
+  // (dim components each), global index
+  std::vector<double> _x, _v, _a;
+  std::vector<uint64_t> _id;
+  // Ghost positions
+  std::vector<double> _ghost;
+  // Own particles and ghosts, in the frame of the box extended by a cutoff
+  Particle_Array _work;
+  Cell_List _cells;
+  // Next acceleration of own particles
+  std::vector<double> _a_next;
+
+  // Results of the last force evaluation on this rank
+  double _E_p;
+  std::vector<double> _virial;
+
+  // This rank's box holds position x
+  bool _owns(const double *);
+  // Send particles that left the box to the neighbouring ranks
+  void _migrate(void);
+  // Receive ghosts from the neighbouring ranks
+  void _exchange_ghosts(void);
+  // Calculate accelerations of own particles, energy and virial
+  void _accelerations(void);
+  // Update positions
+  void _drift(double);
+  // Apply boundary conditions
+  void _boundary(void);
+  // Update velocities and accelerations
+  void _kick(double);
+  // Sum over ranks
+  double _sum(double);
+
+public:
+  // Interaction model
+  Model model;
+
+  // Constructor
+  // IN: number of dimensions, number of particles, mass, initial
+  // temperature, density, boundaries, interaction model, initial placement
+  // (random: no minimum distance), jitter (fraction of the mean spacing),
+  // seed (0: random)
+  // Each particle is placed and given a velocity from its own seed, so the
+  // system does not depend on the number of ranks
+  Domain_Sys(size_t, size_t, double, double, double, Bound, Model,
+             Lattice = lattice_cubic, double = 0, uint64_t = 0);
+  ~Domain_Sys(void);
+
+  Domain_Sys(const Domain_Sys &) = delete;
+  Domain_Sys &operator=(const Domain_Sys &) = delete;
+
+  // Getters
+
+  // Number of dimensions
+  size_t dim(void) const { return Dim ? Dim : _dim; }
+  // Container size
+  double size(size_t i) const { return _size[i]; }
+  // Time
+  double time(void) const { return _time; }
+  // Number of particles in the whole system and on this rank
+  size_t n_particles(void) const { return _n_particles; }
+  size_t n_local(void) const { return _id.size(); }
+  // Number of ghosts on this rank
+  size_t n_ghosts(void) const { return _ghost.size() / dim(); }
+  // Rank and number of ranks
+  int rank(void) const { return _rank; }
+  int n_ranks(void) const { return _n_ranks; }
+  // Kinetic energy
+  double kinetic(void);
+  // Potential energy
+  double potential(void);
+  // Virial tensor component (sum on pairs of s_a F_b)
+  double virial(size_t, size_t);
+  // Pressure
+  double pressure(void);
+
+  // Update
+
+  // Advance time by dt using velocity-Verlet method
+  void vverlet(double);
+
+  // Output
+
+  // Positions of all particles on rank 0, by global index (dim components
+  // each); other ranks get nothing
+  void gather(std::vector<double> &);
+  // Debug (rank 0 prints)
+  void debug(void);
+};
+
+// Domain decomposition
+
+/*    Domain decomposition    */
+
+// Constructor
+template <typename Model, size_t Dim>
+Domain_Sys<Model, Dim>::Domain_Sys(size_t dim_, size_t n_particles,
+                                   double mass, double T_init, double rho,
+                                   Bound bound, Model model_, Lattice lattice,
+                                   double jitter, uint64_t seed)
+    : _dim(Dim ? Dim : dim_), _size(_dim), _time(0), _n_particles(n_particles),
+      _mass(mass), _bound(bound == periodic ? periodic : walls),
+      _cutoff(model_.cutoff()), _comm(MPI_COMM_NULL), _ranks(_dim),
+      _coords(_dim), _below(_dim), _above(_dim), _lo(_dim), _hi(_dim),
+      _work(_dim, 0), _E_p(0), _virial(_dim * _dim), model(model_) {
+
+  // Dummy indices
+  size_t i, j;
+
+  if (Dim && dim_ != Dim)
+    std::cerr << "Error: " << dim_ << "D system requested from Domain_Sys<"
+              << model.name << ", " << Dim << ">, using " << Dim << "D"
+              << '\n';
+
+  // Container size
+  for (i = 0; i < dim(); i++)
+    _size[i] = std::pow(_n_particles * _mass / rho, 1.0 / dim());
+
+  // Grid of ranks
+  int n_world;
+  MPI_Comm_size(MPI_COMM_WORLD, &n_world);
+  std::vector<int> periods(dim(), _bound == periodic);
+  std::fill(_ranks.begin(), _ranks.end(), 0);
+  MPI_Dims_create(n_world, int(dim()), _ranks.data());
+  MPI_Cart_create(MPI_COMM_WORLD, int(dim()), _ranks.data(), periods.data(),
+                  1, &_comm);
+  MPI_Comm_rank(_comm, &_rank);
+  MPI_Comm_size(_comm, &_n_ranks);
+  MPI_Cart_coords(_comm, _rank, int(dim()), _coords.data());
+  for (i = 0; i < dim(); i++) {
+    MPI_Cart_shift(_comm, int(i), 1, &_below[i], &_above[i]);
+    _lo[i] = _size[i] * _coords[i] / _ranks[i];
+    _hi[i] = _size[i] * (_coords[i] + 1) / _ranks[i];
+  }
+
+  // Halos only reach the neighbouring boxes: a box narrower than the cutoff
+  // would miss pairs, so stop (every rank sees the same widths)
+  try {
+    if (!(_cutoff > 0) || std::isinf(_cutoff))
+      throw dim();
+    for (i = 0; i < dim(); i++)
+      if (_hi[i] - _lo[i] < _cutoff)
+        throw i;
+  } catch (size_t bad) {
+    if (_rank == 0) {
+      if (bad == dim())
+        std::cerr << "Error: domain decomposition needs a finite cutoff"
+                  << '\n';
+      else
+        std::cerr << "Error: cutoff " << _cutoff << " larger than the boxes "
+                  << "of width " << _size[bad] / _ranks[bad]
+                  << " along dimension " << bad << " (" << _ranks[bad]
+                  << " ranks)" << '\n';
+    }
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  if (bound == unbounded && _rank == 0)
+    std::cerr << "Error: unbounded system run with walls" << '\n';
+
+  // Same seed on every rank
+  if (seed == 0 && _rank == 0) {
+    std::random_device rnd_dev;
+    seed = (uint64_t(rnd_dev()) << 32) | rnd_dev();
+  }
+  MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, _comm);
+
+  // Positions and velocities: every rank goes through all particles and
+  // keeps its own
+  std::vector<std::uniform_real_distribution<double>> dist_position(dim());
+  for (i = 0; i < dim(); i++)
+    dist_position[i] = std::uniform_real_distribution<double>(0, _size[i]);
+  const Lattice_Sites sites(lattice == lattice_random ? lattice_cubic
+                                                      : lattice,
+                            _size, _n_particles);
+  double volume = 1;
+  for (i = 0; i < dim(); i++)
+    volume *= _size[i];
+  const double spacing = std::pow(volume / _n_particles, 1.0 / dim());
+  std::uniform_real_distribution<double> dist_jitter(-jitter * spacing,
+                                                     jitter * spacing);
+  const double stddev = std::sqrt(K_B * T_init / _mass);
+  std::normal_distribution<double> dist_direction(0, 1);
+  std::normal_distribution<double> dist_speed(0, stddev);
+  Dim_Vector<Dim> x(dim()), v(dim());
+  for (j = 0; j < _n_particles; j++) {
+    std::mt19937_64 engine(splitmix64(seed ^ splitmix64(j)));
+    // Normal distributions keep spare values: start afresh
+    dist_direction.reset();
+    dist_speed.reset();
+    if (lattice == lattice_random)
+      for (i = 0; i < dim(); i++)
+        x[i] = dist_position[i](engine);
+    else {
+      sites.site(j, &x[0]);
+      for (i = 0; i < dim() && jitter > 0; i++) {
+        x[i] += dist_jitter(engine);
+        if (_bound == periodic)
+          x[i] -= std::floor(x[i] / _size[i]) * _size[i];
+        else
+          x[i] = std::min(std::max(x[i], 0.0), _size[i]);
+      }
+    }
+    if (!_owns(&x[0]))
+      continue;
+    double norm = 0;
+    for (i = 0; i < dim(); i++) {
+      v[i] = dist_direction(engine);
+      norm += v[i] * v[i];
+    }
+    norm = std::sqrt(norm);
+    const double speed = dist_speed(engine);
+    for (i = 0; i < dim(); i++) {
+      _x.push_back(x[i]);
+      _v.push_back(v[i] * speed / norm);
+      _a.push_back(0);
+    }
+    _id.push_back(j);
+  }
+
+  // Cells over the box extended by a cutoff on each side
+  std::vector<double> extended(dim());
+  for (i = 0; i < dim(); i++)
+    extended[i] = _hi[i] - _lo[i] + 2 * _cutoff;
+  _cells.setup(extended, _cutoff, 2 * _n_particles / _n_ranks + 1, walls);
+
+  // Calculate accelerations
+  _exchange_ghosts();
+  _accelerations();
+  _a.swap(_a_next);
+}
+
+template <typename Model, size_t Dim> Domain_Sys<Model, Dim>::~Domain_Sys(void) {
+  int finalized;
+  MPI_Finalized(&finalized);
+  if (_comm != MPI_COMM_NULL && !finalized)
+    MPI_Comm_free(&_comm);
+}
+
+// This rank's box holds position x (the edge boxes hold what lies beyond)
+template <typename Model, size_t Dim>
+bool Domain_Sys<Model, Dim>::_owns(const double *x) {
+  for (size_t i = 0; i < dim(); i++) {
+    if (x[i] < _lo[i] && _coords[i] > 0)
+      return false;
+    if (x[i] >= _hi[i] && _coords[i] < _ranks[i] - 1)
+      return false;
+  }
+  return true;
+}
+
+// Sum over ranks
+template <typename Model, size_t Dim>
+double Domain_Sys<Model, Dim>::_sum(double value) {
+  double total;
+  MPI_Allreduce(&value, &total, 1, MPI_DOUBLE, MPI_SUM, _comm);
+  return total;
+}
+
+// Getters
+
+// Kinetic energy
+template <typename Model, size_t Dim> double Domain_Sys<Model, Dim>::kinetic(void) {
+  double E_k = 0;
+  for (double v : _v)
+    E_k += v * v;
+  return _sum(0.5 * _mass * E_k);
+}
+
+// Potential energy
+template <typename Model, size_t Dim> double Domain_Sys<Model, Dim>::potential(void) {
+  return _sum(_E_p);
+}
+
+// Virial tensor component
+template <typename Model, size_t Dim>
+double Domain_Sys<Model, Dim>::virial(size_t a, size_t b) {
+  return _sum(_virial[a * dim() + b]);
+}
+
+// Pressure: (2 kinetic + virial trace) / (dim volume)
+template <typename Model, size_t Dim> double Domain_Sys<Model, Dim>::pressure(void) {
+  size_t i;
+  double vol = 1, trace = 0;
+  for (i = 0; i < dim(); i++) {
+    vol *= _size[i];
+    trace += _virial[i * dim() + i];
+  }
+  return (2 * kinetic() + _sum(trace)) / (dim() * vol);
+}
+
+// Update
+
+// Send particles that left the box to the neighbouring ranks, one
+// dimension at a time
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::_migrate(void) {
+
+  // Dummy indices
+  size_t i, j, s;
+
+  // Record: global index, position, velocity, acceleration
+  const size_t record = 1 + 3 * dim();
+  std::vector<double> out[2], in;
+
+  for (i = 0; i < dim(); i++) {
+    if (_ranks[i] == 1)
+      continue;
+    out[0].clear();
+    out[1].clear();
+    const double L = _size[i], centre = 0.5 * (_lo[i] + _hi[i]);
+    for (j = 0; j < _id.size();) {
+      // Position seen from the box, across the periodic boundary if closer
+      double x = _x[j * dim() + i];
+      if (_bound == periodic)
+        x = centre + (x - centre) - L * std::round((x - centre) / L);
+      int side = -1;
+      if (x < _lo[i] && _below[i] != MPI_PROC_NULL)
+        side = 0;
+      else if (x >= _hi[i] && _above[i] != MPI_PROC_NULL)
+        side = 1;
+      if (side < 0) {
+        j++;
+        continue;
+      }
+      out[side].push_back(double(_id[j]));
+      for (s = 0; s < dim(); s++)
+        out[side].push_back(_x[j * dim() + s]);
+      for (s = 0; s < dim(); s++)
+        out[side].push_back(_v[j * dim() + s]);
+      for (s = 0; s < dim(); s++)
+        out[side].push_back(_a[j * dim() + s]);
+      // Remove: last particle into its place
+      const size_t last = _id.size() - 1;
+      for (s = 0; s < dim(); s++) {
+        _x[j * dim() + s] = _x[last * dim() + s];
+        _v[j * dim() + s] = _v[last * dim() + s];
+        _a[j * dim() + s] = _a[last * dim() + s];
+      }
+      _id[j] = _id[last];
+      _x.resize(last * dim());
+      _v.resize(last * dim());
+      _a.resize(last * dim());
+      _id.pop_back();
+    }
+
+    // Down then up
+    for (int side = 0; side < 2; side++) {
+      const int to = side ? _above[i] : _below[i],
+                from = side ? _below[i] : _above[i];
+      long n_out = long(out[side].size()), n_in = 0;
+      MPI_Sendrecv(&n_out, 1, MPI_LONG, to, 0, &n_in, 1, MPI_LONG, from, 0,
+                   _comm, MPI_STATUS_IGNORE);
+      in.resize(n_in);
+      MPI_Sendrecv(out[side].data(), int(n_out), MPI_DOUBLE, to, 1, in.data(),
+                   int(n_in), MPI_DOUBLE, from, 1, _comm, MPI_STATUS_IGNORE);
+      for (j = 0; j + record <= in.size(); j += record) {
+        _id.push_back(uint64_t(in[j]));
+        for (s = 0; s < dim(); s++)
+          _x.push_back(in[j + 1 + s]);
+        for (s = 0; s < dim(); s++)
+          _v.push_back(in[j + 1 + dim() + s]);
+        for (s = 0; s < dim(); s++)
+          _a.push_back(in[j + 1 + 2 * dim() + s]);
+      }
+    }
+  }
+}
+
+// Receive ghosts from the neighbouring ranks, one dimension at a time,
+// forwarding those received along earlier dimensions
+template <typename Model, size_t Dim>
+void Domain_Sys<Model, Dim>::_exchange_ghosts(void) {
+
+  // Dummy indices
+  size_t i, j, s;
+
+  std::vector<double> out[2], in;
+  _ghost.clear();
+
+  for (i = 0; i < dim(); i++) {
+    out[0].clear();
+    out[1].clear();
+    const double L = _size[i];
+    const size_t n_own = _id.size(), n_ghost = _ghost.size() / dim();
+    for (j = 0; j < n_own + n_ghost; j++) {
+      const double *x = j < n_own ? &_x[j * dim()] : &_ghost[(j - n_own) * dim()];
+      // Near the lower side: to the rank below, one period up if it wraps
+      if (x[i] < _lo[i] + _cutoff && _below[i] != MPI_PROC_NULL) {
+        for (s = 0; s < dim(); s++)
+          out[0].push_back(x[s]);
+        if (_coords[i] == 0)
+          out[0][out[0].size() - dim() + i] += L;
+      }
+      // Near the upper side: to the rank above, one period down if it wraps
+      if (x[i] >= _hi[i] - _cutoff && _above[i] != MPI_PROC_NULL) {
+        for (s = 0; s < dim(); s++)
+          out[1].push_back(x[s]);
+        if (_coords[i] == _ranks[i] - 1)
+          out[1][out[1].size() - dim() + i] -= L;
+      }
+    }
+
+    for (int side = 0; side < 2; side++) {
+      const int to = side ? _above[i] : _below[i],
+                from = side ? _below[i] : _above[i];
+      long n_out = long(out[side].size()), n_in = 0;
+      MPI_Sendrecv(&n_out, 1, MPI_LONG, to, 2, &n_in, 1, MPI_LONG, from, 2,
+                   _comm, MPI_STATUS_IGNORE);
+      in.resize(n_in);
+      MPI_Sendrecv(out[side].data(), int(n_out), MPI_DOUBLE, to, 3, in.data(),
+                   int(n_in), MPI_DOUBLE, from, 3, _comm, MPI_STATUS_IGNORE);
+      _ghost.insert(_ghost.end(), in.begin(), in.end());
+    }
+  }
+}
+
+// Calculate accelerations of own particles, energy and virial
+template <typename Model, size_t Dim>
+void Domain_Sys<Model, Dim>::_accelerations(void) {
+
+  // Dummy indices
+  size_t i, j;
+
+  // Own particles then ghosts, shifted into the extended box
+  const size_t n_own = _id.size(), n = n_own + n_ghosts();
+  if (_work.size() != n)
+    _work = Particle_Array(dim(), n);
+  for (i = 0; i < dim(); i++) {
+    const double origin = _lo[i] - _cutoff;
+    double *x = _work.x(i);
+    for (j = 0; j < n_own; j++)
+      x[j] = _x[j * dim() + i] - origin;
+    for (j = n_own; j < n; j++)
+      x[j] = _ghost[(j - n_own) * dim() + i] - origin;
+  }
+  _cells.build(_work);
+
+  _a_next.assign(n_own * dim(), 0);
+  _E_p = 0;
+  std::fill(_virial.begin(), _virial.end(), 0.0);
+  const double cut2 = _cutoff * _cutoff;
+  Dim_Vector<Dim> s(dim());
+  _cells.for_each_pair([&](size_t j, size_t k) {
+    const bool own_j = j < n_own, own_k = k < n_own;
+    if (!own_j && !own_k)
+      return;
+    double d2 = 0;
+    for (size_t a = 0; a < dim(); a++) {
+      s[a] = _work.x(j, a) - _work.x(k, a);
+      d2 += s[a] * s[a];
+    }
+    if (d2 >= cut2)
+      return;
+    // Pairs with a ghost are also evaluated on the ghost's rank
+    const double w = own_j && own_k ? 1 : 0.5;
+    double k_f;
+    _E_p += w * model.pair(d2, k_f);
+    const double k_a = k_f / _mass;
+    for (size_t a = 0; a < dim(); a++) {
+      if (own_j)
+        _a_next[j * dim() + a] += k_a * s[a];
+      if (own_k)
+        _a_next[k * dim() + a] -= k_a * s[a];
+      for (size_t b = 0; b < dim(); b++)
+        _virial[a * dim() + b] += w * k_f * s[a] * s[b];
+    }
+  });
+}
+
+// Update positions
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::_drift(double dt) {
+  for (size_t e = 0; e < _x.size(); e++)
+    _x[e] += _v[e] * dt + 0.5 * _a[e] * dt * dt;
+}
+
+// Apply boundary conditions
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::_boundary(void) {
+  size_t i, j;
+  for (j = 0; j < _id.size(); j++)
+    for (i = 0; i < dim(); i++) {
+      double &x = _x[j * dim() + i], &v = _v[j * dim() + i];
+      const double L = _size[i];
+      if (_bound == walls) {
+        if (x < 0) {
+          x = -x;
+          v = -v;
+        } else if (x > L) {
+          x = 2 * L - x;
+          v = -v;
+        }
+      } else {
+        if (x < 0)
+          x += L;
+        else if (x >= L)
+          x -= L;
+      }
+    }
+}
+
+// Update velocities and accelerations
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::_kick(double dt) {
+  for (size_t e = 0; e < _v.size(); e++)
+    _v[e] += 0.5 * (_a[e] + _a_next[e]) * dt;
+  _a.swap(_a_next);
+}
+
+// Velocity-Verlet
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::vverlet(double dt) {
+
+  // Update time
+  _time += dt;
+
+  // Update positions
+  _drift(dt);
+
+  // Check boundaries
+  _boundary();
+
+  // Hand over particles that changed box, then refresh ghosts
+  _migrate();
+  _exchange_ghosts();
+
+  // Calculate new acceleration
+  _accelerations();
+
+  // Update velocities
+  _kick(dt);
+}
+
+// Output
+
+// Positions of all particles on rank 0, by global index
+template <typename Model, size_t Dim>
+void Domain_Sys<Model, Dim>::gather(std::vector<double> &x) {
+
+  // Dummy indices
+  size_t i, j;
+
+  // Records: global index and position
+  const size_t record = 1 + dim();
+  std::vector<double> out;
+  for (j = 0; j < _id.size(); j++) {
+    out.push_back(double(_id[j]));
+    for (i = 0; i < dim(); i++)
+      out.push_back(_x[j * dim() + i]);
+  }
+  int n_out = int(out.size());
+  std::vector<int> counts(_n_ranks), offsets(_n_ranks);
+  MPI_Gather(&n_out, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, _comm);
+  std::vector<double> in;
+  if (_rank == 0) {
+    int total = 0;
+    for (int r = 0; r < _n_ranks; r++) {
+      offsets[r] = total;
+      total += counts[r];
+    }
+    in.resize(total);
+  }
+  MPI_Gatherv(out.data(), n_out, MPI_DOUBLE, in.data(), counts.data(),
+              offsets.data(), MPI_DOUBLE, 0, _comm);
+  x.clear();
+  if (_rank != 0)
+    return;
+  x.resize(_n_particles * dim());
+  for (j = 0; j + record <= in.size(); j += record) {
+    const size_t id = size_t(in[j]);
+    for (i = 0; i < dim(); i++)
+      x[id * dim() + i] = in[j + 1 + i];
+  }
+}
+
+// Debug
+template <typename Model, size_t Dim> void Domain_Sys<Model, Dim>::debug(void) {
+
+  // Dummy index
+  size_t i;
+
+  // Collective parts first
+  const double E_k = kinetic(), E_p = potential();
+  long n_own = long(n_local()), n_min, n_max;
+  MPI_Reduce(&n_own, &n_min, 1, MPI_LONG, MPI_MIN, 0, _comm);
+  MPI_Reduce(&n_own, &n_max, 1, MPI_LONG, MPI_MAX, 0, _comm);
+  if (_rank != 0)
+    return;
+
+  std::cerr << '\n';
+  std::cerr << std::setprecision(6) << std::scientific;
+  std::cerr << dim() << "D: " << _n_particles << " particles on " << _n_ranks
+            << " ranks (" << n_min << " to " << n_max << " each)"
+            << "\n\n";
+  std::cerr << "Model: " << model.name << "\n\n";
+  std::cerr << "Boundary conditions: "
+            << (_bound == periodic ? "periodic" : "walls") << "\n\n";
+  std::cerr << "Ranks along each dimension:" << '\n';
+  for (i = 0; i < dim(); i++)
+    std::cerr << _ranks[i] << '\n';
+  std::cerr << '\n';
+  std::cerr << "Container size:" << '\n';
+  for (i = 0; i < dim(); i++)
+    std::cerr << _size[i] << '\n';
+  std::cerr << '\n';
+  std::cerr << "Kinetic energy: " << E_k << '\n';
+  std::cerr << "Potential energy: " << E_p << '\n';
+  std::cerr << '\n';
+}
+
+// Domain decomposition
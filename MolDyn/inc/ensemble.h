@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "moldyn.h"
+
+/*    Replica ensemble   */
+
+// Many small independent systems (replicas) in one process, each with its
+// own seed and initial temperature. A run advances every replica by the same
+// number of steps; each replica is one task on a pool of worker threads, so
+// tiny systems are parallel over replicas instead of inside their force
+// loops (replicas are given one thread each).
+// Tasks are dealt round robin to the workers' deques. A worker takes tasks
+// from the back of its own deque and, once it is empty, steals from the
+// front of the others': replicas that run slower (hotter, denser, more
+// rebuilds) do not leave the other workers idle.
+// The sink is shared: calls are serialized, in no particular replica order.
+
+/*    Task deque   */
+
+class Task_Deque {
+
+  std::deque<size_t> _tasks;
+  std::mutex _mutex;
+
+public:
+  // Add a task at the back
+  void push(size_t);
+  // Take a task from the back (owner) or the front (thief)
+  // OUT: false if empty
+  bool pop(size_t &);
+  bool steal(size_t &);
+};
+
+// Task deque
+
+// System: any system with vverlet(dt) and set_threads(n), e.g. NewtonSys
+template <typename System> class Ensemble {
+
+public:
+  // Builds a replica
+  // IN: seed, initial temperature
+  typedef std::function<System *(unsigned, double)> Factory;
+  // Output of a replica
+  // IN: replica index, replica
+  typedef std::function<void(size_t, System &)> Sink;
+
+private:
+  Factory _factory;
+  // Seeds of replicas added without one derive from this
+  uint64_t _base_seed;
+  std::vector<unsigned> _seeds;
+  std::vector<double> _T_init;
+  // Built by the first run
+  std::vector<std::unique_ptr<System>> _replicas;
+  size_t _n_workers;
+  Sink _sink;
+  size_t _n_every;
+  std::mutex _sink_mutex;
+  // Tasks taken from another worker's deque, over all runs
+  std::atomic<size_t> _n_steals;
+
+  // Advance replica r: n steps of dt
+  void _task(size_t, size_t, double);
+
+public:
+  // Constructor
+  // IN: factory, number of worker threads (0: hardware threads)
+  Ensemble(Factory, size_t = 0);
+
+  // Add a replica
+  // IN: initial temperature, seed (0: derived from random_seed() and the
+  // index, repeatable with MOLDYN_SEED)
+  // OUT: its index
+  size_t add(double, unsigned = 0);
+
+  // Shared output: called with a replica every n steps of a run (0: only
+  // after the last one)
+  void set_sink(Sink, size_t = 0);
+
+  // Getters
+  size_t n_replicas(void) const { return _seeds.size(); }
+  size_t n_workers(void) const { return _n_workers; }
+  size_t n_steals(void) const { return _n_steals.load(); }
+  unsigned seed(size_t r) const { return _seeds[r]; }
+  double T_init(size_t r) const { return _T_init[r]; }
+  // Replica (null before the first run)
+  System *replica(size_t r) { return _replicas[r].get(); }
+
+  // Advance every replica n steps of dt; returns when all are done
+  void run(size_t, double);
+};
+
+// Replica ensemble
+
+/*    Task deque   */
+
+// Add a task at the back
+void Task_Deque::push(size_t task) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _tasks.push_back(task);
+}
+
+// Take a task from the back
+bool Task_Deque::pop(size_t &task) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_tasks.empty())
+    return false;
+  task = _tasks.back();
+  _tasks.pop_back();
+  return true;
+}
+
+// Take a task from the front
+bool Task_Deque::steal(size_t &task) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_tasks.empty())
+    return false;
+  task = _tasks.front();
+  _tasks.pop_front();
+  return true;
+}
+
+// Task deque
+
+/*    Replica ensemble   */
+
+// Constructor
+template <typename System>
+Ensemble<System>::Ensemble(Factory factory, size_t n_workers)
+    : _factory(factory), _base_seed(random_seed()), _n_every(0),
+      _n_steals(0) {
+  _n_workers = n_workers ? n_workers : std::thread::hardware_concurrency();
+  if (_n_workers == 0)
+    _n_workers = 1;
+}
+
+// Add a replica
+template <typename System>
+size_t Ensemble<System>::add(double T_init, unsigned seed) {
+  const size_t r = _seeds.size();
+  if (seed == 0)
+    seed = unsigned(splitmix64(_base_seed ^ splitmix64(r))) | 1;
+  _seeds.push_back(seed);
+  _T_init.push_back(T_init);
+  _replicas.emplace_back();
+  return r;
+}
+
+// Shared output
+template <typename System>
+void Ensemble<System>::set_sink(Sink sink, size_t n_every) {
+  _sink = sink;
+  _n_every = n_every;
+}
+
+// Advance replica r
+template <typename System>
+void Ensemble<System>::_task(size_t r, size_t n_steps, double dt) {
+
+  // Dummy index
+  size_t step;
+
+  // Built on the worker, in parallel with the others, on this thread alone
+  // (the constructor already evaluates forces)
+  if (!_replicas[r]) {
+    const int n_threads = max_threads();
+    set_max_threads(1);
+    _replicas[r].reset(_factory(_seeds[r], _T_init[r]));
+    set_max_threads(n_threads);
+    _replicas[r]->set_threads(1);
+  }
+  System &sys = *_replicas[r];
+
+  for (step = 1; step <= n_steps; step++) {
+    sys.vverlet(dt);
+    if (!_sink || (step != n_steps && (_n_every == 0 || step % _n_every)))
+      continue;
+    std::lock_guard<std::mutex> lock(_sink_mutex);
+    _sink(r, sys);
+  }
+}
+
+// Advance every replica
+template <typename System>
+void Ensemble<System>::run(size_t n_steps, double dt) {
+
+  // Dummy indices
+  size_t r, w;
+
+  const size_t n_workers = std::min(_n_workers, n_replicas());
+  if (n_workers == 0)
+    return;
+
+  // Deal the replicas round robin
+  std::vector<Task_Deque> deques(n_workers);
+  for (r = 0; r < n_replicas(); r++)
+    deques[r % n_workers].push(r);
+
+  // No task creates others: a worker that finds every deque empty is done
+  auto worker = [&](size_t w) {
+    size_t task = 0, u;
+    while (1) {
+      if (deques[w].pop(task)) {
+        _task(task, n_steps, dt);
+        continue;
+      }
+      for (u = 1; u < n_workers; u++)
+        if (deques[(w + u) % n_workers].steal(task))
+          break;
+      if (u == n_workers)
+        return;
+      _n_steals++;
+      _task(task, n_steps, dt);
+    }
+  };
+
+  // The calling thread is worker 0
+  std::vector<std::thread> threads;
+  for (w = 1; w < n_workers; w++)
+    threads.emplace_back(worker, w);
+  worker(0);
+  for (std::thread &t : threads)
+    t.join();
+}
+
+// Replica ensemble
@@ -0,0 +1,513 @@
+#pragma once
+
+#include <complex>
+
+#include "moldyn.h"
+
+/*    FFT   */
+
+typedef std::complex<double> Complex;
+
+// In-place radix-2 FFT of n values (a power of 2) spaced by step
+// sign: -1 forward, +1 backward (not normalized)
+void fft(Complex *, size_t, size_t, int);
+
+// In-place FFT of a 3D array of K[0] x K[1] x K[2] values (last index
+// fastest), one axis at a time
+void fft_3d(Complex *, const size_t *, int);
+
+// Smallest power of 2 not below n
+inline size_t next_pow2(size_t n) {
+  size_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+// FFT
+
+/*    Ewald Coulomb model   */
+
+// Point charges in a periodic container (3 dimensions) through smooth
+// particle-mesh Ewald (Essmann et al., J. Chem. Phys. 103, 8577 (1995)).
+// The 1 / r interaction is split by erfc(alpha r) / r, summed on pairs within
+// the cutoff, and a smooth remainder, summed in reciprocal space: charges are
+// spread on a mesh with cardinal B-splines, transformed by FFT, multiplied by
+// the influence function and transformed back, at O(N log N) cost.
+// alpha and the mesh follow from the cutoff and a relative tolerance. A net
+// charge is compensated by a uniform background.
+// The pair functions of the model interface give the real-space term for
+// unit charges; NewtonSys uses the charges of the particles.
+class Ewald_Coulomb {
+
+  // Charges of the particles
+  std::vector<double> _charge;
+  // Coulomb constant
+  double _k_e;
+  // Cutoff radius, splitting parameter, relative tolerance
+  double _r_cut, _alpha, _tolerance;
+  // Order of the B-splines
+  size_t _order;
+
+  // Mesh: container size and number of points along each dimension
+  double _box[3];
+  size_t _K[3];
+  // Charge mesh and its transforms
+  std::vector<Complex> _Q;
+  // Influence function: B-spline moduli times Ewald kernel, and the virial
+  // factor 2 (1 + pi^2 m^2 / alpha^2) / m^2 (0 at m = 0)
+  std::vector<double> _BC, _V;
+  // B-spline weights and derivatives of each particle, dimension, point,
+  // and lowest mesh index of each particle and dimension
+  std::vector<double> _theta, _dtheta;
+  std::vector<long> _base;
+
+  // Set up the mesh for a container
+  void _setup(const double *);
+
+public:
+  // Name
+  static const std::string name;
+  // Constructor
+  // IN: charges of the particles, cutoff radius, relative tolerance,
+  // B-spline order (at least 3), Coulomb constant
+  Ewald_Coulomb(const std::vector<double> &, double, double = 1e-5,
+                size_t = 6, double = 1);
+  // Set parameters
+  void set_charges(const std::vector<double> &);
+  void set_cutoff(double);
+  // Getters
+  double charge(size_t j) const { return _charge[j]; }
+  double alpha(void) const { return _alpha; }
+  size_t mesh(size_t i) const { return _K[i]; }
+  // Interaction range of the real-space part
+  double cutoff(void) const { return _r_cut; }
+  // Potential energy (real-space part, unit charges)
+  double potential(double) const;
+  double potential(const double *, size_t) const;
+  double potential(const Particle &, const Particle &) const;
+  // Force (real-space part, unit charges)
+  double k_force(double) const;
+  void force(const double *, size_t, double *) const;
+  void force(const Particle &, const Particle &, double *) const;
+  // Force multiplier and potential energy (real-space part, unit charges)
+  double pair(double, double &) const;
+  // Reciprocal-space part, self energy and background of n particles
+  // OUT: potential energy
+  double reciprocal(const Pair_Data &, size_t);
+};
+
+// Row of pairs for Ewald models: real-space part with the particle charges
+template <size_t Dim>
+double pair_row(Ewald_Coulomb &, const Pair_Data &, size_t, const size_t *,
+                size_t);
+
+// Reciprocal-space part for Ewald models
+template <size_t Dim>
+double long_range(Ewald_Coulomb &, const Pair_Data &, size_t);
+
+// Charges follow the particles when their storage is reordered
+void reorder_model(Ewald_Coulomb &, const size_t *, size_t);
+
+// Double precision only (charges and reciprocal sum work on double pair data)
+template <> struct Reduced_Precision<Ewald_Coulomb> : std::false_type {};
+
+// Ewald Coulomb model
+
+/*    FFT   */
+
+// In-place radix-2 FFT
+void fft(Complex *a, size_t n, size_t step, int sign) {
+  size_t i, j, len, k;
+  // Bit reversal permutation
+  for (i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap(a[i * step], a[j * step]);
+  }
+  // Butterflies
+  for (len = 2; len <= n; len <<= 1) {
+    const double angle = sign * 2 * PI / len;
+    const Complex w_len(std::cos(angle), std::sin(angle));
+    for (i = 0; i < n; i += len) {
+      Complex w(1, 0);
+      for (k = 0; k < len / 2; k++) {
+        Complex u = a[(i + k) * step], v = a[(i + k + len / 2) * step] * w;
+        a[(i + k) * step] = u + v;
+        a[(i + k + len / 2) * step] = u - v;
+        w *= w_len;
+      }
+    }
+  }
+}
+
+// In-place 3D FFT
+void fft_3d(Complex *a, const size_t *K, int sign) {
+  const long K0 = K[0], K1 = K[1], K2 = K[2];
+  // Along the last index
+#pragma omp parallel for schedule(static)
+  for (long l = 0; l < K0 * K1; l++)
+    fft(a + l * K2, K2, 1, sign);
+  // Along the middle index
+#pragma omp parallel for schedule(static)
+  for (long l = 0; l < K0 * K2; l++)
+    fft(a + (l / K2) * K1 * K2 + l % K2, K1, K2, sign);
+  // Along the first index
+#pragma omp parallel for schedule(static)
+  for (long l = 0; l < K1 * K2; l++)
+    fft(a + l, K0, K1 * K2, sign);
+}
+
+// FFT
+
+/*    Ewald Coulomb model   */
+
+// Name
+const std::string Ewald_Coulomb::name = "Coulomb (particle-mesh Ewald)";
+
+// Cardinal B-spline weights M_p(w + p - 1 - j), j = 0 .. p - 1, and their
+// derivatives, for the fractional part w of a scaled coordinate
+inline void bspline(double w, size_t p, double *M, double *dM) {
+  size_t j, k;
+  double div;
+  // Order 2, then up to p - 1
+  M[p - 1] = 0;
+  M[1] = w;
+  M[0] = 1 - w;
+  for (k = 3; k < p; k++) {
+    div = 1.0 / (k - 1);
+    M[k - 1] = div * w * M[k - 2];
+    for (j = 1; j + 1 < k; j++)
+      M[k - j - 1] = div * ((w + j) * M[k - j - 2] + (k - j - w) * M[k - j - 1]);
+    M[0] = div * (1 - w) * M[0];
+  }
+  // Derivatives from order p - 1
+  dM[0] = -M[0];
+  for (j = 1; j < p; j++)
+    dM[j] = M[j - 1] - M[j];
+  // Order p
+  div = 1.0 / (p - 1);
+  M[p - 1] = div * w * M[p - 2];
+  for (j = 1; j + 1 < p; j++)
+    M[p - j - 1] = div * ((w + j) * M[p - j - 2] + (p - j - w) * M[p - j - 1]);
+  M[0] = div * (1 - w) * M[0];
+}
+
+// Constructor
+Ewald_Coulomb::Ewald_Coulomb(const std::vector<double> &charge, double r_cut,
+                             double tolerance, size_t order, double k_e)
+    : _charge(charge), _k_e(k_e), _r_cut(r_cut), _tolerance(tolerance),
+      _order(order < 3 ? 3 : order), _box{0, 0, 0}, _K{0, 0, 0} {
+  set_cutoff(r_cut);
+}
+
+// Set charges
+void Ewald_Coulomb::set_charges(const std::vector<double> &charge) {
+  _charge = charge;
+}
+
+// Set cutoff: alpha such that erfc(alpha r_cut) is the tolerance
+void Ewald_Coulomb::set_cutoff(double r_cut) {
+  _r_cut = r_cut;
+  double lo = 0, hi = 1;
+  while (std::erfc(hi * r_cut) > _tolerance)
+    hi *= 2;
+  for (int it = 0; it < 60; it++) {
+    double mid = 0.5 * (lo + hi);
+    (std::erfc(mid * r_cut) > _tolerance ? lo : hi) = mid;
+  }
+  _alpha = hi;
+  // Mesh set up again on next use
+  _box[0] = 0;
+}
+
+// Potential energy (real-space part, unit charges)
+double Ewald_Coulomb::potential(double d2) const {
+  double r = std::sqrt(d2);
+  return _k_e * std::erfc(_alpha * r) / r;
+}
+double Ewald_Coulomb::potential(const double *s, size_t dim) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  return potential(d2);
+}
+double Ewald_Coulomb::potential(const Particle &part1,
+                                const Particle &part2) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  return potential(d2);
+}
+
+// Force (real-space part, unit charges)
+double Ewald_Coulomb::k_force(double d2) const {
+  double k;
+  pair(d2, k);
+  return k;
+}
+void Ewald_Coulomb::force(const double *s, size_t dim, double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  double k = k_force(d2);
+  for (size_t i = 0; i < dim; i++)
+    F[i] = k * s[i];
+}
+void Ewald_Coulomb::force(const Particle &part1, const Particle &part2,
+                          double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  double k = k_force(d2);
+  for (size_t i = 0; i < part1.dim; i++)
+    F[i] = k * (part1.x[i] - part2.x[i]);
+}
+
+// Force multiplier and potential energy (real-space part, unit charges)
+double Ewald_Coulomb::pair(double d2, double &k) const {
+  const double r = std::sqrt(d2), ar = _alpha * r;
+  const double E = _k_e * std::erfc(ar) / r;
+  k = (E + _k_e * 2 * _alpha / std::sqrt(PI) * std::exp(-ar * ar)) / d2;
+  return E;
+}
+
+// Set up the mesh for a container
+void Ewald_Coulomb::_setup(const double *box) {
+  size_t i, m[3];
+  const size_t p = _order;
+  // Reciprocal terms up to exp(-pi^2 m^2 / alpha^2) ~ tolerance
+  const double m_max = _alpha * std::sqrt(-std::log(_tolerance)) / PI;
+  for (i = 0; i < 3; i++) {
+    _box[i] = box[i];
+    _K[i] = std::max(next_pow2(size_t(std::ceil(2 * m_max * box[i]))),
+                     next_pow2(p));
+  }
+  const size_t n_mesh = _K[0] * _K[1] * _K[2];
+  _Q.assign(n_mesh, 0);
+  _BC.assign(n_mesh, 0);
+  _V.assign(n_mesh, 0);
+
+  // B-spline moduli |b(m)|^2 along each dimension
+  std::vector<double> M(p), dM(p), B[3];
+  bspline(0, p, M.data(), dM.data());
+  for (i = 0; i < 3; i++) {
+    const size_t K = _K[i];
+    B[i].resize(K);
+    for (size_t k = 0; k < K; k++) {
+      Complex den(0, 0);
+      // M_p(l + 1) = M[p - 2 - l]
+      for (size_t l = 0; l + 1 < p; l++)
+        den += M[p - 2 - l] * std::polar(1.0, 2 * PI * k * l / K);
+      B[i][k] = std::norm(den) > 1e-14 ? 1 / std::norm(den) : 0;
+    }
+    // Zeros of odd orders (k = K / 2): average of the neighbours
+    for (size_t k = 0; k < K; k++)
+      if (B[i][k] == 0)
+        B[i][k] = 0.5 * (B[i][(k + K - 1) % K] + B[i][(k + 1) % K]);
+  }
+
+  // Influence function
+  const double V = box[0] * box[1] * box[2];
+  for (m[0] = 0; m[0] < _K[0]; m[0]++)
+    for (m[1] = 0; m[1] < _K[1]; m[1]++)
+      for (m[2] = 0; m[2] < _K[2]; m[2]++) {
+        double m2 = 0, b = 1;
+        for (i = 0; i < 3; i++) {
+          const double mi =
+              double(m[i] <= _K[i] / 2 ? long(m[i]) : long(m[i]) - long(_K[i])) /
+              box[i];
+          m2 += mi * mi;
+          b *= B[i][m[i]];
+        }
+        const size_t e = (m[0] * _K[1] + m[1]) * _K[2] + m[2];
+        if (m2 == 0)
+          continue;
+        const double f = PI * PI * m2 / (_alpha * _alpha);
+        _BC[e] = _k_e * b * std::exp(-f) / (PI * V * m2);
+        _V[e] = 2 * (1 + f) / m2;
+      }
+}
+
+// Reciprocal-space part, self energy and background
+double Ewald_Coulomb::reciprocal(const Pair_Data &d, size_t n) {
+
+  // Dummy indices
+  size_t i, j, a, b, c;
+
+  const size_t p = _order, stride = d.stride;
+  try {
+    if (d.dim != 3 || !d.box || _charge.size() != n)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: Ewald sum needs 3 dimensions, periodic boundaries "
+                 "and one charge per particle"
+              << '\n';
+    return 0;
+  }
+  if (_box[0] != d.box[0] || _box[1] != d.box[1] || _box[2] != d.box[2])
+    _setup(d.box);
+  const size_t K0 = _K[0], K1 = _K[1], K2 = _K[2];
+  const double V = d.box[0] * d.box[1] * d.box[2];
+
+  // B-spline weights of every particle
+  _theta.resize(n * 3 * p);
+  _dtheta.resize(n * 3 * p);
+  _base.resize(n * 3);
+#pragma omp parallel for private(i) schedule(static)
+  for (long jl = 0; jl < long(n); jl++) {
+    const size_t j = jl;
+    for (i = 0; i < 3; i++) {
+      double u = d.x[i * stride + j] / d.box[i] * _K[i];
+      u -= std::floor(u / _K[i]) * _K[i];
+      const double fl = std::floor(u);
+      bspline(u - fl, p, &_theta[(j * 3 + i) * p], &_dtheta[(j * 3 + i) * p]);
+      _base[j * 3 + i] = long(fl) - long(p) + 1;
+    }
+  }
+
+  // Spread charges
+  std::fill(_Q.begin(), _Q.end(), 0);
+  for (j = 0; j < n; j++) {
+    const double q = _charge[j];
+    const double *t0 = &_theta[j * 3 * p], *t1 = t0 + p, *t2 = t1 + p;
+    for (a = 0; a < p; a++) {
+      const size_t k0 = (_base[j * 3] + a + K0) % K0;
+      for (b = 0; b < p; b++) {
+        const size_t k1 = (_base[j * 3 + 1] + b + K1) % K1;
+        const double w = q * t0[a] * t1[b];
+        Complex *row = &_Q[(k0 * K1 + k1) * K2];
+        for (c = 0; c < p; c++)
+          row[(_base[j * 3 + 2] + c + K2) % K2] += w * t2[c];
+      }
+    }
+  }
+
+  // Energy and virial in reciprocal space, then convolution
+  fft_3d(_Q.data(), _K, -1);
+  double E = 0, W[6] = {0, 0, 0, 0, 0, 0};
+  size_t m[3];
+  for (m[0] = 0; m[0] < K0; m[0]++)
+    for (m[1] = 0; m[1] < K1; m[1]++)
+      for (m[2] = 0; m[2] < K2; m[2]++) {
+        const size_t e = (m[0] * K1 + m[1]) * K2 + m[2];
+        const double E_m = 0.5 * _BC[e] * std::norm(_Q[e]);
+        double mv[3];
+        for (i = 0; i < 3; i++)
+          mv[i] = double(m[i] <= _K[i] / 2 ? long(m[i])
+                                           : long(m[i]) - long(_K[i])) /
+                  d.box[i];
+        E += E_m;
+        W[0] += E_m * (1 - _V[e] * mv[0] * mv[0]);
+        W[1] += E_m * (1 - _V[e] * mv[1] * mv[1]);
+        W[2] += E_m * (1 - _V[e] * mv[2] * mv[2]);
+        W[3] -= E_m * _V[e] * mv[0] * mv[1];
+        W[4] -= E_m * _V[e] * mv[0] * mv[2];
+        W[5] -= E_m * _V[e] * mv[1] * mv[2];
+        _Q[e] *= _BC[e];
+      }
+  fft_3d(_Q.data(), _K, +1);
+
+  // Forces: gradient of the interpolated potential
+#pragma omp parallel for private(a, b, c) schedule(static)
+  for (long jl = 0; jl < long(n); jl++) {
+    const size_t j = jl;
+    const double *t0 = &_theta[j * 3 * p], *t1 = t0 + p, *t2 = t1 + p;
+    const double *d0 = &_dtheta[j * 3 * p], *d1 = d0 + p, *d2 = d1 + p;
+    double f0 = 0, f1 = 0, f2 = 0;
+    for (a = 0; a < p; a++) {
+      const size_t k0 = (_base[j * 3] + a + K0) % K0;
+      for (b = 0; b < p; b++) {
+        const size_t k1 = (_base[j * 3 + 1] + b + K1) % K1;
+        const Complex *row = &_Q[(k0 * K1 + k1) * K2];
+        for (c = 0; c < p; c++) {
+          const double phi = row[(_base[j * 3 + 2] + c + K2) % K2].real();
+          f0 += d0[a] * t1[b] * t2[c] * phi;
+          f1 += t0[a] * d1[b] * t2[c] * phi;
+          f2 += t0[a] * t1[b] * d2[c] * phi;
+        }
+      }
+    }
+    const double qs = -_charge[j] * d.scale;
+    d.acc[j] += qs * f0 * _K[0] / d.box[0];
+    d.acc[stride + j] += qs * f1 * _K[1] / d.box[1];
+    d.acc[2 * stride + j] += qs * f2 * _K[2] / d.box[2];
+  }
+
+  // Self energy and neutralizing background
+  double Q_tot = 0, Q2 = 0;
+  for (j = 0; j < n; j++) {
+    Q_tot += _charge[j];
+    Q2 += _charge[j] * _charge[j];
+  }
+  const double E_self = -_k_e * _alpha / std::sqrt(PI) * Q2;
+  const double E_bg = -_k_e * PI * Q_tot * Q_tot / (2 * V * _alpha * _alpha);
+
+  // Virial (acceleration units, as the pair rows)
+  const size_t ab[6][2] = {{0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2}};
+  for (i = 0; i < 6; i++) {
+    double w = (W[i] + (i < 3 ? E_bg : 0)) * d.scale;
+    d.virial[ab[i][0] * 3 + ab[i][1]] += w;
+    if (i >= 3)
+      d.virial[ab[i][1] * 3 + ab[i][0]] += w;
+  }
+
+  return E + E_self + E_bg;
+}
+
+// Row of pairs for Ewald models: real-space part with the particle charges
+template <size_t Dim>
+double pair_row(Ewald_Coulomb &model, const Pair_Data &d, size_t j,
+                const size_t *k, size_t m) {
+  size_t i, b, p;
+  const size_t dim = Dim ? Dim : d.dim;
+  double E_p = 0;
+  Dim_Vector<Dim> s(dim);
+  const double q_j = model.charge(j);
+  for (p = 0; p < m; p++) {
+    double d2 = 0;
+    for (i = 0; i < dim; i++) {
+      double x = d.x[i * d.stride + j] - d.x[i * d.stride + k[p]];
+      if (d.box) {
+        if (x > 0.5 * d.box[i])
+          x -= d.box[i];
+        else if (x < -0.5 * d.box[i])
+          x += d.box[i];
+      }
+      s[i] = x;
+      d2 += x * x;
+    }
+    if (d2 >= d.cut2)
+      continue;
+    double k_a;
+    const double qq = q_j * model.charge(k[p]);
+    E_p += qq * model.pair(d2, k_a);
+    k_a *= qq * d.scale;
+    for (i = 0; i < dim; i++) {
+      d.acc[i * d.stride + j] += k_a * s[i];
+      d.acc[i * d.stride + k[p]] -= k_a * s[i];
+      for (b = 0; b < dim; b++)
+        d.virial[i * dim + b] += k_a * s[i] * s[b];
+    }
+  }
+  return E_p;
+}
+
+// Reciprocal-space part for Ewald models
+template <size_t Dim>
+double long_range(Ewald_Coulomb &model, const Pair_Data &d, size_t n) {
+  return model.reciprocal(d, n);
+}
+
+// Charges follow the particles
+void reorder_model(Ewald_Coulomb &model, const size_t *order, size_t n) {
+  std::vector<double> charge(n);
+  for (size_t j = 0; j < n; j++)
+    charge[j] = model.charge(order[j]);
+  model.set_charges(charge);
+}
+
+// Ewald Coulomb model
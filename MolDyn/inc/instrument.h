@@ -0,0 +1,278 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+
+/*    Instrumentation   */
+
+// Time spent in each phase of a step, pairs evaluated, neighbour list
+// rebuilds and allocations, kept by each system in a Counters record.
+// Compiled in with -DMOLDYN_PROFILE: without it phase timers are empty and
+// only steps, pairs and rebuilds (plain increments) are counted.
+// Allocations are counted process-wide (all threads) by replacing the global
+// operator new, with MOLDYN_PROFILE or MOLDYN_COUNT_ALLOCS; the replacement
+// is defined here, so only one translation unit of a program may include
+// this header with either macro.
+
+#ifdef MOLDYN_PROFILE
+#ifndef MOLDYN_COUNT_ALLOCS
+#define MOLDYN_COUNT_ALLOCS
+#endif
+const bool PROFILING = true;
+#else
+const bool PROFILING = false;
+#endif
+
+// Phases of a step
+enum Phase {
+  phase_drift,
+  phase_boundary,
+  phase_force,
+  phase_kick,
+  phase_reorder,
+  phase_output,
+  n_phases
+};
+const char *const PHASE_NAMES[n_phases] = {"drift", "boundary", "force",
+                                           "kick", "reorder", "output"};
+
+// Counters of a system since construction (or the last reset)
+struct Counters {
+  uint64_t steps = 0;
+  // Wall time of each phase (MOLDYN_PROFILE only)
+  double seconds[n_phases] = {};
+  // Pair interactions evaluated (listed pairs of each force evaluation)
+  uint64_t pairs = 0;
+  // Neighbour list rebuilds
+  uint64_t rebuilds = 0;
+  // Allocations during steps, by any thread (MOLDYN_PROFILE only)
+  uint64_t allocs = 0;
+
+  void reset(void) { *this = Counters(); }
+};
+
+// Allocations so far (counted with MOLDYN_COUNT_ALLOCS)
+inline std::atomic<uint64_t> n_allocs(0);
+
+// Adds the wall time of its scope to a phase
+#ifdef MOLDYN_PROFILE
+class Phase_Timer {
+  double &_seconds;
+  std::chrono::steady_clock::time_point _start;
+
+public:
+  Phase_Timer(Counters &c, Phase p)
+      : _seconds(c.seconds[p]), _start(std::chrono::steady_clock::now()) {}
+  ~Phase_Timer(void) {
+    _seconds += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - _start)
+                    .count();
+  }
+};
+#else
+class Phase_Timer {
+public:
+  Phase_Timer(Counters &, Phase) {}
+};
+#endif
+
+// Output
+
+// One JSON object on a line
+// IN: stream, label, time of the system, counters
+void write_json_line(std::ostream &, const std::string &, double,
+                     const Counters &);
+// Prometheus text format, replacing the file atomically
+// IN: file name, label, counters
+bool write_prometheus(const std::string &, const std::string &,
+                      const Counters &);
+
+// Dumps the counters of a system every period (wall time): JSON lines
+// appended to a file, or a Prometheus text file rewritten each time
+class Profile_Dump {
+
+  std::string _name, _label;
+  bool _prometheus;
+  std::chrono::steady_clock::duration _period;
+  std::chrono::steady_clock::time_point _last;
+  std::ofstream _file;
+
+public:
+  // Constructor
+  // IN: file name, label, seconds between dumps, Prometheus (else JSON
+  // lines)
+  Profile_Dump(const std::string &, const std::string &, double = 10,
+               bool = false);
+
+  // Call after each step (or batch of steps) of a system with counters()
+  // and time()
+  template <typename System> void tick(System &);
+};
+
+// Instrumentation
+
+/*    Instrumentation   */
+
+#ifdef MOLDYN_COUNT_ALLOCS
+// The whole set is replaced, every operator kept out of line: compilers see
+// neither malloc() behind new nor free() behind delete, so they cannot pair
+// them up across the replacement
+#if defined(__GNUC__)
+#define MOLDYN_NOINLINE __attribute__((noinline))
+#else
+#define MOLDYN_NOINLINE
+#endif
+// Counted allocation (null on failure)
+MOLDYN_NOINLINE void *counted_alloc(size_t n, size_t align) {
+  n_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (align <= alignof(std::max_align_t))
+    return std::malloc(n ? n : 1);
+  return std::aligned_alloc(align, (n + align - 1) / align * align);
+}
+MOLDYN_NOINLINE void *operator new(size_t n) {
+  if (void *p = counted_alloc(n, 0))
+    return p;
+  throw std::bad_alloc();
+}
+MOLDYN_NOINLINE void *operator new[](size_t n) {
+  if (void *p = counted_alloc(n, 0))
+    return p;
+  throw std::bad_alloc();
+}
+MOLDYN_NOINLINE void *operator new(size_t n, std::align_val_t align) {
+  if (void *p = counted_alloc(n, size_t(align)))
+    return p;
+  throw std::bad_alloc();
+}
+MOLDYN_NOINLINE void *operator new[](size_t n, std::align_val_t align) {
+  if (void *p = counted_alloc(n, size_t(align)))
+    return p;
+  throw std::bad_alloc();
+}
+MOLDYN_NOINLINE void *operator new(size_t n, const std::nothrow_t &) noexcept {
+  return counted_alloc(n, 0);
+}
+MOLDYN_NOINLINE void *operator new[](size_t n,
+                                     const std::nothrow_t &) noexcept {
+  return counted_alloc(n, 0);
+}
+MOLDYN_NOINLINE void *operator new(size_t n, std::align_val_t align,
+                                   const std::nothrow_t &) noexcept {
+  return counted_alloc(n, size_t(align));
+}
+MOLDYN_NOINLINE void *operator new[](size_t n, std::align_val_t align,
+                                     const std::nothrow_t &) noexcept {
+  return counted_alloc(n, size_t(align));
+}
+MOLDYN_NOINLINE void operator delete(void *p) noexcept { std::free(p); }
+MOLDYN_NOINLINE void operator delete[](void *p) noexcept { std::free(p); }
+MOLDYN_NOINLINE void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete[](void *p, size_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete(void *p, std::align_val_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete[](void *p, std::align_val_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete(void *p, size_t,
+                                     std::align_val_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete[](void *p, size_t,
+                                       std::align_val_t) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete(void *p,
+                                     const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete[](void *p,
+                                       const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete(void *p, std::align_val_t,
+                                     const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+MOLDYN_NOINLINE void operator delete[](void *p, std::align_val_t,
+                                       const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+#endif
+
+// One JSON object on a line
+void write_json_line(std::ostream &out, const std::string &label, double time,
+                     const Counters &c) {
+  out << "{\"label\": \"" << label << "\", \"time\": " << time
+      << ", \"steps\": " << c.steps << ", \"seconds\": {";
+  for (int p = 0; p < n_phases; p++)
+    out << (p ? ", \"" : "\"") << PHASE_NAMES[p] << "\": " << c.seconds[p];
+  out << "}, \"pairs\": " << c.pairs << ", \"rebuilds\": " << c.rebuilds
+      << ", \"allocs\": " << c.allocs << "}" << '\n';
+  out.flush();
+}
+
+// Prometheus text format
+bool write_prometheus(const std::string &name, const std::string &label,
+                      const Counters &c) {
+  const std::string temp = name + ".tmp", tag = "{system=\"" + label + "\"";
+  std::ofstream out(temp);
+  out << "# TYPE moldyn_steps_total counter" << '\n';
+  out << "moldyn_steps_total" << tag << "} " << c.steps << '\n';
+  out << "# TYPE moldyn_phase_seconds_total counter" << '\n';
+  for (int p = 0; p < n_phases; p++)
+    out << "moldyn_phase_seconds_total" << tag << ",phase=\""
+        << PHASE_NAMES[p] << "\"} " << c.seconds[p] << '\n';
+  out << "# TYPE moldyn_pairs_total counter" << '\n';
+  out << "moldyn_pairs_total" << tag << "} " << c.pairs << '\n';
+  out << "# TYPE moldyn_rebuilds_total counter" << '\n';
+  out << "moldyn_rebuilds_total" << tag << "} " << c.rebuilds << '\n';
+  out << "# TYPE moldyn_allocs_total counter" << '\n';
+  out << "moldyn_allocs_total" << tag << "} " << c.allocs << '\n';
+  out.close();
+  try {
+    if (!out || std::rename(temp.c_str(), name.c_str()) != 0)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot write " << name << '\n';
+    return false;
+  }
+  return true;
+}
+
+// Constructor
+Profile_Dump::Profile_Dump(const std::string &name, const std::string &label,
+                           double period, bool prometheus)
+    : _name(name), _label(label), _prometheus(prometheus),
+      _period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(period))),
+      _last(std::chrono::steady_clock::now()) {
+  if (!_prometheus)
+    _file.open(_name, std::ios::app);
+}
+
+// Call after each step
+template <typename System> void Profile_Dump::tick(System &sys) {
+  const auto now = std::chrono::steady_clock::now();
+  if (now - _last < _period)
+    return;
+  _last = now;
+  if (_prometheus)
+    write_prometheus(_name, _label, sys.counters());
+  else
+    write_json_line(_file, _label, sys.time(), sys.counters());
+}
+
+// Instrumentation
@@ -1,16 +1,70 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <random>
+#include <sstream>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "checkpoint.h"
+#include "instrument.h"
+#include "snapshot.h"
+
 // Constants
 const double PI = 3.141592653589793;
 const double K_B = 1.3806485279e-23;
 const double N_A = 6.02214085774e23;
+const double INF = std::numeric_limits<double>::infinity();
+
+/*    Dimensions    */
+
+// Number of dimensions fixed at compile time (0: only known at run time)
+// Kernels are specialized for 2 and 3 dimensions
+
+// Vector of Dim components, on the stack when Dim is known
+template <size_t Dim> struct Dim_Vector {
+  std::array<double, Dim> c;
+  Dim_Vector(size_t) {}
+  double &operator[](size_t i) { return c[i]; }
+  double operator[](size_t i) const { return c[i]; }
+};
+template <> struct Dim_Vector<0> {
+  std::vector<double> c;
+  Dim_Vector(size_t dim) : c(dim) {}
+  double &operator[](size_t i) { return c[i]; }
+  double operator[](size_t i) const { return c[i]; }
+};
+
+// Call f(std::integral_constant<size_t, Dim>) with the compile-time
+// dimension matching dim (Dim = 0 for dimensions without a specialization)
+template <typename F> auto with_dim(size_t dim, F f) {
+  switch (dim) {
+  case 2:
+    return f(std::integral_constant<size_t, 2>());
+  case 3:
+    return f(std::integral_constant<size_t, 3>());
+  default:
+    return f(std::integral_constant<size_t, 0>());
+  }
+}
+
+// Dimensions
 
 /*    Particles     */
 struct Particle {
@@ -29,6 +83,344 @@ struct Particle {
 
 // Particle
 
+/*    Aligned storage   */
+
+// Alignment of particle arrays (one cache line)
+const size_t ALIGNMENT = 64;
+
+// Allocator returning memory aligned to ALIGNMENT bytes
+template <typename T> struct Aligned_Allocator {
+  typedef T value_type;
+  Aligned_Allocator(void) {}
+  template <typename U> Aligned_Allocator(const Aligned_Allocator<U> &) {}
+  T *allocate(size_t n) {
+    return static_cast<T *>(
+        ::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+  }
+  void deallocate(T *p, size_t) {
+    ::operator delete(p, std::align_val_t(ALIGNMENT));
+  }
+  template <typename U> struct rebind { typedef Aligned_Allocator<U> other; };
+};
+
+template <typename T, typename U>
+bool operator==(const Aligned_Allocator<T> &, const Aligned_Allocator<U> &) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const Aligned_Allocator<T> &, const Aligned_Allocator<U> &) {
+  return false;
+}
+
+// Vector with cache line aligned storage
+template <typename T> using aligned_vector = std::vector<T, Aligned_Allocator<T>>;
+
+// Aligned storage
+
+/*    Precision   */
+
+// Floating-point precision of a system, as a policy class providing
+//   real          positions, velocities and accelerations (particle storage)
+//   force_real    arithmetic of the pair kernels that have a version for it
+//   name          static const char *
+// Energies, virial, container size and time stay double. Mixed keeps double
+// storage and integration with float pair arithmetic (separations are taken
+// in double first); float stores and computes everything in float, halving
+// the memory traffic of the force loop.
+struct Double_Precision {
+  typedef double real;
+  typedef double force_real;
+  static constexpr const char *name = "double";
+};
+struct Mixed_Precision {
+  typedef double real;
+  typedef float force_real;
+  static constexpr const char *name = "mixed";
+};
+struct Float_Precision {
+  typedef float real;
+  typedef float force_real;
+  static constexpr const char *name = "float";
+};
+
+// Whether a model runs in mixed or float precision: models whose forces need
+// more than their pair function (charges, long-range parts) specialize it to
+// false and only run in double
+template <typename Model> struct Reduced_Precision : std::true_type {};
+
+// Precision
+
+/*    Threads   */
+
+// Number of threads available (1 without OpenMP)
+int max_threads(void) {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Threads for parallel regions the calling thread starts (no effect without
+// OpenMP)
+void set_max_threads(int n) {
+#ifdef _OPENMP
+  omp_set_num_threads(n);
+#else
+  (void)n;
+#endif
+}
+
+// Index of the calling thread (0 without OpenMP)
+int thread_id(void) {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// Number of threads of the current team (1 without OpenMP): may be fewer
+// than asked for (nested regions, thread limits, dynamic teams)
+int team_size(void) {
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+// Rows of pairs handed to a thread at a time
+const long ROW_CHUNK = 64;
+
+// Threads
+
+/*    Random numbers    */
+
+// Seed for new systems: MOLDYN_SEED from the environment if set (repeatable
+// runs, e.g. benchmarks), else from the random device
+unsigned random_seed(void) {
+  const char *env = std::getenv("MOLDYN_SEED");
+  if (env && *env)
+    return unsigned(std::strtoul(env, nullptr, 10));
+  return std::random_device()();
+}
+
+// Mix a seed and an index (particle, replica) into a seed of its own
+inline uint64_t splitmix64(uint64_t z) {
+  z += 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Random numbers
+
+/*    Particle arrays   */
+
+// Structure of arrays: positions, velocities and accelerations are each kept
+// in a single aligned block, one contiguous row per component.
+// Component i of particle j is x(i)[j]; every row starts on a cache line.
+// Real: type of the components (see Precision)
+template <typename Real> class Basic_Particle_Array {
+
+  // Number of dimensions
+  size_t _dim;
+  // Number of particles
+  size_t _n;
+  // Distance between component rows (n rounded up to a cache line)
+  size_t _stride;
+  // Position, velocity and acceleration
+  aligned_vector<Real> _x, _v, _a;
+
+public:
+  // Constructor
+  // Number of dimensions and number of particles
+  Basic_Particle_Array(size_t, size_t);
+
+  // Getters
+  size_t dim(void) const { return _dim; }
+  size_t size(void) const { return _n; }
+  size_t stride(void) const { return _stride; }
+
+  // Component rows
+  Real *x(size_t i) { return _x.data() + i * _stride; }
+  Real *v(size_t i) { return _v.data() + i * _stride; }
+  Real *a(size_t i) { return _a.data() + i * _stride; }
+  const Real *x(size_t i) const { return _x.data() + i * _stride; }
+  const Real *v(size_t i) const { return _v.data() + i * _stride; }
+  const Real *a(size_t i) const { return _a.data() + i * _stride; }
+
+  // Single component of particle j
+  Real &x(size_t j, size_t i) { return _x[i * _stride + j]; }
+  Real &v(size_t j, size_t i) { return _v[i * _stride + j]; }
+  Real &a(size_t j, size_t i) { return _a[i * _stride + j]; }
+  Real x(size_t j, size_t i) const { return _x[i * _stride + j]; }
+  Real v(size_t j, size_t i) const { return _v[i * _stride + j]; }
+  Real a(size_t j, size_t i) const { return _a[i * _stride + j]; }
+
+  // Whole acceleration block, swapped with a buffer of the same layout
+  void swap_a(aligned_vector<Real> &a) { _a.swap(a); }
+  // Reorder the particles: slot j takes particle order[j]
+  // IN: order, buffer of the same layout (overwritten)
+  void permute(const size_t *, aligned_vector<Real> &);
+
+  // Copy of particle j
+  Particle particle(size_t, double) const;
+};
+
+// Double precision particle arrays
+typedef Basic_Particle_Array<double> Particle_Array;
+
+// Reorder a block of component rows: entry j of each row takes entry
+// order[j]; the buffer (same size) is swapped in, the old block comes out
+// IN: block, number of rows, distance between rows, order, number of
+// entries, buffer
+template <typename Real>
+void permute_rows(aligned_vector<Real> &, size_t, size_t, const size_t *,
+                  size_t, aligned_vector<Real> &);
+
+// Particle arrays
+
+/*    Pair rows   */
+
+// Arrays a row of pairs (particle j against a list of partners k) works on.
+// Positions and accelerations are component rows as in Particle_Array.
+// Real: type of positions and accelerations; Calc: arithmetic of the kernels
+// that have a version for it (see Precision)
+template <typename Real, typename Calc = Real> struct Basic_Pair_Data {
+  // Number of dimensions
+  size_t dim;
+  // Distance between component rows
+  size_t stride;
+  // Positions
+  const Real *x;
+  // Accelerations: a pair adds its force / mass to j and subtracts it from k
+  Real *acc;
+  // Virial: a pair adds s_a F_b / mass to entry a * dim + b (dim x dim)
+  double *virial;
+  // Container size for the minimum image (null for walls)
+  const double *box;
+  // Squared cutoff
+  double cut2;
+  // Force to acceleration factor (1 / mass)
+  double scale;
+};
+
+// Double precision pair data (models overload pair rows for these)
+typedef Basic_Pair_Data<double> Pair_Data;
+
+// Generic row of pairs through the model radial force and potential (in
+// double, whatever the precision)
+// Dim: number of dimensions if known at compile time (else 0)
+// OUT: potential energy of the row (each pair once)
+template <size_t Dim, typename Model, typename Real, typename Calc>
+double pair_row(Model &, const Basic_Pair_Data<Real, Calc> &, size_t,
+                const size_t *, size_t);
+
+// Long-range part of a model, beyond the cutoff (e.g. Ewald reciprocal sum),
+// added to accelerations and virial of all n particles as pair rows do
+// OUT: its potential energy (none unless the model overloads it)
+template <size_t Dim, typename Model, typename Real, typename Calc>
+double long_range(Model &, const Basic_Pair_Data<Real, Calc> &, size_t) {
+  return 0;
+}
+
+// Parts of the forces for multiple time steps (RESPA): fast ones are
+// integrated with the inner step, slow ones with the outer step. Without a
+// distance switch pair rows are fast and the long-range part is slow; with
+// one, a pair force is shared as S F (fast) and (1 - S) F (slow), S going
+// smoothly from 1 to 0 between two radii.
+enum Force_Part { part_all, part_fast, part_slow };
+
+// Share of a pair force in a part
+// IN: part, squared distance, squared radii where the switch starts and ends
+inline double part_weight(Force_Part, double, double, double);
+
+// Row of pairs through the model pair force, weighted for a part, optionally
+// skipping the pairs of full weight (left to pair_row())
+// OUT: potential energy of the row, weighted the same way
+template <size_t Dim, typename Model, typename Real, typename Calc>
+double switched_row(Model &, const Basic_Pair_Data<Real, Calc> &, size_t,
+                    const size_t *, size_t, Force_Part, double, double,
+                    bool = false);
+
+// Pair rows
+
+/*    SIMD dispatch   */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MOLDYN_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Instruction sets for vectorized pair kernels
+enum Simd { simd_scalar, simd_avx2, simd_avx512 };
+
+// Best instruction set supported by the running CPU
+// (MOLDYN_SIMD=scalar|avx2|avx512 in the environment caps it)
+Simd simd_level(void);
+
+// SIMD dispatch
+
+/*    Interaction models    */
+
+// A pair model provides
+//   name                       static std::string
+//   cutoff()                   interaction range (0: none, INF: unbounded)
+//   potential(d2)              pair energy at squared distance d2
+//   k_force(d2)                force on 1 due to 2 is k_force(d2) * (x1 - x2)
+//   pair(d2, k)                energy, with k_force(d2) stored in k
+//   potential(s, dim)          energy for a separation vector s
+//   force(s, dim, F)           force for a separation vector, written to F
+//   potential(p1, p2)          energy of a pair of particles
+//   force(p1, p2, F)           force on p1 due to p2, written to F
+// Results go to caller-provided storage and arguments are read through const
+// references or pointers: evaluating a pair never allocates. Whole rows of
+// pairs go through pair_row(), which a model may overload; a model with a
+// part beyond the cutoff overloads long_range(). Checkpoints keep the bytes
+// of trivially copyable models; other models may overload save_model() and
+// load_model(), else they are left as constructed on restore. A checkpoint
+// only restores into a system of the model it was written with (model_id()).
+// Models with data per particle overload reorder_model().
+
+// Id of a model in checkpoint headers: hash of its type name and size
+template <typename Model> uint64_t model_id(const Model &) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char *c = typeid(Model).name(); *c; c++)
+    h = (h ^ uint8_t(*c)) * 0x100000001b3ULL;
+  return (h ^ sizeof(Model)) * 0x100000001b3ULL;
+}
+
+// Save model parameters as the next checkpoint block
+template <typename Model> void save_model(const Model &model, Ckpt_Writer &w) {
+  if (std::is_trivially_copyable<Model>::value)
+    w.add(&model, sizeof(Model));
+  else
+    w.add(nullptr, 0);
+}
+
+// Load model parameters from the next checkpoint block
+// OUT: false if the block is missing or not what save_model() writes
+template <typename Model> bool load_model(Model &model, Ckpt_Reader &r) {
+  size_t bytes;
+  const char *data = r.block(bytes);
+  if (!std::is_trivially_copyable<Model>::value)
+    return data && bytes == 0;
+  if (!data || bytes != sizeof(Model))
+    return false;
+  std::memcpy(static_cast<void *>(&model), data, sizeof(Model));
+  return true;
+}
+
+// Reorder per-particle data of a model (e.g. charges) with the particles:
+// slot j takes the data of slot order[j] (none unless the model overloads
+// it)
+// IN: model, order, number of particles
+template <typename Model> void reorder_model(Model &, const size_t *, size_t) {}
+
+// Interaction models
+
 /*    Ideal gas model   */
 
 class Ideal_Gas {
@@ -38,17 +430,24 @@ public:
   static const std::string name;
   // Default Constructor
   Ideal_Gas(void) {}
+  // Interaction range (no interaction)
+  double cutoff(void) const { return 0; }
   // Potential energy
-  double potential(double) { return 0; }
-  double potential(std::vector<double> &) { return 0; }
-  double potential(Particle, Particle) { return 0; }
+  double potential(double) const { return 0; }
+  double potential(const double *, size_t) const { return 0; }
+  double potential(const Particle &, const Particle &) const { return 0; }
   // Force
-  double k_force(double) { return 0; }
-  std::vector<double> force(std::vector<double> &s) {
-    return std::vector<double>(s.size());
+  double k_force(double) const { return 0; }
+  void force(const double *, size_t dim, double *F) const {
+    std::fill(F, F + dim, 0.0);
+  }
+  void force(const Particle &part1, const Particle &, double *F) const {
+    std::fill(F, F + part1.dim, 0.0);
   }
-  std::vector<double> force(Particle part1, Particle) {
-    return std::vector<double>(part1.dim);
+  // Force multiplier and potential energy
+  double pair(double, double &k) const {
+    k = 0;
+    return 0;
   }
 };
 
@@ -62,48 +461,276 @@ const std::string Ideal_Gas::name = "Ideal gas";
 class Lennard_Jones {
 
   // Parameters
-  double _epsilon, _sigma6, _sigma12, _sigma8, _sigma14;
+  double _epsilon, _sigma, _sigma2;
+  // Cutoff radius in units of sigma
+  double _r_cut;
+  // Unshifted energy at the cutoff, taken off every pair so that the energy
+  // is continuous there (and conserved)
+  double _shift;
+
+  void _update_shift(void);
 
 public:
   // Name
   static const std::string name;
   // Default Constructor
-  Lennard_Jones()
-      : _epsilon(1), _sigma6(1), _sigma12(1), _sigma8(1), _sigma14(1) {}
+  Lennard_Jones() : _epsilon(1), _sigma(1), _sigma2(1), _r_cut(2.5) {
+    _update_shift();
+  }
   // Constructor with parameters
-  Lennard_Jones(double epsilon, double sigma)
-      : _epsilon(epsilon), _sigma6(std::pow(sigma, 6)),
-        _sigma12(std::pow(sigma, 12)), _sigma8(std::pow(sigma, 8)),
-        _sigma14(std::pow(sigma, 14)) {}
+  // Cutoff radius in units of sigma (INF for no cutoff); the potential is
+  // shifted to zero at the cutoff
+  Lennard_Jones(double epsilon, double sigma, double r_cut = 2.5)
+      : _epsilon(epsilon), _sigma(sigma), _sigma2(sigma * sigma),
+        _r_cut(r_cut) {
+    _update_shift();
+  }
   // Set parameters
   void set_epsilon(double);
   void set_sigma(double);
-  // Potential energy
-  double potential(double);
-  double potential(std::vector<double> &);
-  double potential(Particle, Particle);
+  void set_cutoff(double);
+  // Interaction range: pairs further apart than this are ignored
+  double cutoff(void) const { return _r_cut * _sigma; }
+  // Energy shift at the cutoff (0 without cutoff)
+  double shift(void) const { return _shift; }
+  // Potential energy (shifted, for pairs within the cutoff)
+  double potential(double) const;
+  double potential(const double *, size_t) const;
+  double potential(const Particle &, const Particle &) const;
   // Force
-  double k_force(double);
-  std::vector<double> force(std::vector<double> &);
-  std::vector<double> force(Particle, Particle);
+  double k_force(double) const;
+  void force(const double *, size_t, double *) const;
+  void force(const Particle &, const Particle &, double *) const;
+  // Force multiplier and potential energy
+  double pair(double, double &) const;
+  // Row of pairs, vectorized (AVX2 / AVX-512 when available), in the
+  // arithmetic of the pair data
+  template <size_t Dim, typename Real, typename Calc>
+  double force_row(const Basic_Pair_Data<Real, Calc> &, size_t,
+                   const size_t *, size_t);
   // Output
   void plot_potential(size_t, double, double);
   void plot_force(size_t, double, double);
 };
 
+// Row of pairs for Lennard-Jones models
+template <size_t Dim, typename Real, typename Calc>
+double pair_row(Lennard_Jones &, const Basic_Pair_Data<Real, Calc> &, size_t,
+                const size_t *, size_t);
+
 // Lennard_Jones model
 
 /*    Boundaries    */
 
-enum Bound { walls, periodic };
+// Unbounded: no boundaries, particles may leave the container (which then
+// only sets the initial region and the density)
+enum Bound { walls, periodic, unbounded };
 
 // Boundaries
 
+/*    Initial placement   */
+
+// Random: uniform in the container, optionally no closer than a minimum
+// distance. Lattices fill the container with whole cells and take the first
+// n sites evenly spread over it: cubic (square in 2D, simple cubic in 3D,
+// any number of dimensions), hexagonal (2D, rows stretched to fit the
+// container), BCC and FCC (3D).
+enum Lattice { lattice_random, lattice_cubic, lattice_hex, lattice_bcc,
+               lattice_fcc };
+
+// Sites of a lattice filling a container, n of them evenly spread
+class Lattice_Sites {
+
+  size_t _n, _n_sites;
+  // Container size
+  std::vector<double> _size;
+  // Cells along each side
+  std::vector<size_t> _n_cells;
+  // Sites of a cell in units of the cell side
+  std::vector<std::vector<double>> _basis;
+
+public:
+  // Constructor
+  // IN: lattice (not random), container size, number of sites used
+  Lattice_Sites(Lattice, const std::vector<double> &, size_t);
+
+  // Site j of n: dim components written to x
+  void site(size_t, double *) const;
+};
+
+// Initial placement
+
+/*    Space-filling curves    */
+
+// Orders of the cells of a grid of 2^bits cells per side, for particle
+// storage (see NewtonSys::set_reorder). Morton interleaves the bits of the
+// cell coordinates; Hilbert also rotates and reflects the sub-grids, so that
+// cells next on the curve are always next in space.
+enum Curve { curve_morton, curve_hilbert };
+
+// Position of a cell along a curve (dim * bits <= 64)
+// IN: curve, number of dimensions, cell coordinates (overwritten), bits
+uint64_t curve_key(Curve, size_t, uint64_t *, unsigned);
+
+// Space-filling curves
+
+/*    Cell list   */
+
+// Binned spatial decomposition of the container into cells at least one
+// cutoff wide. Particles are counting-sorted by cell, so the particles of a
+// cell are a contiguous range of _cell_particles. Interacting pairs are only
+// searched for among neighbouring cells, wrapped across the container for
+// periodic boundaries.
+class Cell_List {
+
+  // Number of dimensions
+  size_t _dim;
+  // Boundary conditions
+  Bound _bound;
+  // Cutoff the grid was set up for
+  double _cutoff;
+  // Number of cells along each dimension and in total
+  std::vector<size_t> _n_cells;
+  size_t _n_total;
+  // Inverse cell width along each dimension
+  std::vector<double> _inv_width;
+  // Neighbouring cells of each cell (itself included, no repetitions)
+  std::vector<size_t> _neighbor_start, _neighbors;
+  // First entry of each cell in _cell_particles
+  std::vector<size_t> _cell_start;
+  // Cell of each particle
+  std::vector<size_t> _cell_of;
+  // Particle indices sorted by cell
+  std::vector<size_t> _cell_particles;
+  // Next free entry of each cell while sorting
+  std::vector<size_t> _fill;
+
+public:
+  // Default Constructor
+  Cell_List(void) : _dim(0), _bound(walls), _cutoff(-1), _n_total(0) {}
+
+  // Set up the grid
+  // IN: container size, cutoff, number of particles, boundaries
+  void setup(const std::vector<double> &, double, size_t, Bound);
+  // Sort particles into cells
+  template <typename Real> void build(const Basic_Particle_Array<Real> &);
+
+  // Getters
+  double cutoff(void) const { return _cutoff; }
+  size_t n_cells(void) const { return _n_total; }
+  size_t n_particles(void) const { return _cell_particles.size(); }
+
+  // Call f(j, k) once for every pair j < k in neighbouring cells
+  template <typename F> void for_each_pair(F) const;
+  // Same, restricted to the particles in a range of cell order
+  template <typename F> void for_each_pair(F, size_t, size_t) const;
+};
+
+// Cell list
+
+/*    Neighbour list    */
+
+// Verlet list: the pairs closer than cutoff + skin, kept in compressed rows
+// (one row per particle j holding its partners k > j). The list stays valid
+// until some particle has moved more than half the skin since it was built;
+// only then are particles binned into cells again.
+class Neighbor_List {
+
+  // Skin around the cutoff
+  double _skin;
+  // Number of rebuilds
+  size_t _rebuilds;
+  // Whether the list matches the current positions
+  bool _valid;
+  // Pairs are not listed (infinite range): the cell list is used directly
+  bool _all_pairs;
+  // Binning used to build the list
+  Cell_List _cells;
+  // Rows: particle of each row and first entry of each row in _neighbors
+  std::vector<size_t> _row_particle, _row_start;
+  // Partners k > j of each row
+  std::vector<size_t> _neighbors;
+  // Positions at the last build (same layout as the particle arrays)
+  aligned_vector<double> _x_ref;
+  // Squared displacement of each particle since the last build
+  std::vector<double> _disp2;
+
+  // Build the list from the current positions
+  template <typename Real>
+  void _build(const Basic_Particle_Array<Real> &, const std::vector<double> &,
+              Bound);
+  // Largest squared displacement since the last build
+  template <typename Real>
+  double _max_disp2(const Basic_Particle_Array<Real> &,
+                    const std::vector<double> &, Bound);
+
+public:
+  // Default Constructor
+  Neighbor_List(void)
+      : _skin(0), _rebuilds(0), _valid(false), _all_pairs(false) {}
+
+  // Set skin (forces a rebuild)
+  void set_skin(double skin) {
+    _skin = skin;
+    _valid = false;
+  }
+  // Force a rebuild, on a new grid, on the next update (e.g. positions or
+  // container were set by hand)
+  void invalidate(void) {
+    _valid = false;
+    _cells = Cell_List();
+  }
+
+  // Getters
+  double skin(void) const { return _skin; }
+  size_t rebuilds(void) const { return _rebuilds; }
+  size_t n_pairs(void) const { return _neighbors.size(); }
+  // Number of rows (units of work for for_each_pair)
+  size_t n_rows(void) const {
+    return _all_pairs ? _cells.n_particles() : _row_particle.size();
+  }
+  // Whether pairs are listed in rows (false for infinite range)
+  bool listed(void) const { return !_all_pairs; }
+
+  // Rebuild the list if needed
+  // IN: particles, container size, cutoff, boundaries
+  // OUT: true if the list was rebuilt
+  template <typename Real>
+  bool update(const Basic_Particle_Array<Real> &, const std::vector<double> &,
+              double, Bound);
+
+  // Call f(j, k) once for every listed pair
+  template <typename F> void for_each_pair(F) const;
+  // Same, restricted to a range of rows
+  template <typename F> void for_each_pair(F, size_t, size_t) const;
+  // Call f(j, k, m) for every listed row in a range: j against k[0..m)
+  template <typename F> void for_each_row(F, size_t, size_t) const;
+};
+
+// Neighbour list
+
 /*    Newtonian System of particles   */
 
-template <typename Model> class NewtonSys {
+// Model: interaction model
+// Dim: number of dimensions fixed at compile time, 0 to choose at run time
+// Precision: Double_Precision, Mixed_Precision or Float_Precision
+template <typename Model, size_t Dim = 0,
+          typename Precision = Double_Precision>
+class NewtonSys {
+
+  static_assert(std::is_same<Precision, Double_Precision>::value ||
+                    Reduced_Precision<Model>::value,
+                "this model only runs in double precision");
+
+public:
+  // Storage and pair arithmetic types
+  typedef typename Precision::real real;
+  typedef typename Precision::force_real force_real;
 
 private:
+  // Arrays for the pair kernels
+  typedef Basic_Pair_Data<real, force_real> Data;
+
   // Number of dimensions
   const size_t _dim;
   // Size of container
@@ -115,102 +742,796 @@ private:
   // Mass of each particle
   double _mass;
   // Particles
-  std::vector<Particle> _particles;
+  Basic_Particle_Array<real> _particles;
+  // Next acceleration (same layout as the particle arrays)
+  aligned_vector<real> _a_next;
   // Boundary conditions
   Bound _bound;
   // Initial energy
   double _kinetic_0;
   double _potential_0;
+  // Neighbour search, and pairs within the switch radius for the fast part
+  // of a switched RESPA split (same skin)
+  Neighbor_List _neighbors, _short_neighbors;
+  // Number of threads for force evaluation
+  int _n_threads;
+  // Force buffers of threads 1, 2, ... (thread 0 writes to the result)
+  std::vector<aligned_vector<real>> _thread_acc;
+  // Potential energy and virial partial sums of each thread, then of the
+  // long-range part
+  std::vector<double> _thread_E_p, _thread_virial;
+  // Results of the last force evaluation: potential energy and virial
+  // tensor (sum on pairs of s_a F_b), valid until positions change
+  double _E_p;
+  std::vector<double> _virial;
+  bool _fresh;
+  // Part of the forces the accelerations in the particle arrays hold
+  Force_Part _a_part;
+  // Slow accelerations for multiple time steps
+  aligned_vector<real> _a_slow;
+  // Squared radii of the fast/slow distance switch (0: no switch)
+  double _switch_in2, _switch_out2;
+  // Random number generator (kept in checkpoints)
+  std::mt19937 _mersenne_engine;
+  // Instrumentation
+  Counters _counters;
+  // Storage order: ID of the particle in each slot, curve, steps between
+  // reorderings (0: never) and since the last one
+  std::vector<size_t> _ids;
+  Curve _curve;
+  size_t _reorder_every, _reorder_count;
+  // Curve key of each slot and new order of the slots
+  std::vector<uint64_t> _keys;
+  std::vector<size_t> _order;
+
+  // Separation vector between particles j and k and its length squared
+  template <typename V> double _separation(size_t, size_t, V &);
+  // Bring the neighbour list up to date with the positions
+  void _update_neighbors(void);
+  // Same for the list of the fast part
+  void _update_short_neighbors(void);
+
+  // Velocity-Verlet phases
+
+  // Update positions
+  void _drift(double);
+  // Apply boundary conditions
+  void _boundary(void);
+  // Calculate accelerations into a buffer laid out as the particle arrays,
+  // with potential energy and virial in the same pass (only meaningful for
+  // all the forces)
+  void _accelerations(real *, Force_Part = part_all);
+  // Evaluate forces if positions changed since the last evaluation
+  void _refresh(void);
+  // Update velocities and accelerations
+  void _kick(double);
+
+  // Place particles: lattice, jitter (fraction of the mean spacing),
+  // minimum distance for random placement, random engine
+  template <typename Engine> void _place(Lattice, double, double, Engine &);
+  // Random placement no closer than a minimum distance
+  template <typename Engine> void _place_random(double, Engine &);
 
 public:
   // Interaction model
   Model model;
 
+  // Setters
+
+  // Neighbour list skin
+  void set_skin(double);
+  // Number of threads for force evaluation
+  void set_threads(int);
+  // Fast/slow split for multiple time steps: pair forces switch from fast
+  // to slow between r - width and r (r <= 0 or beyond the cutoff: pair
+  // forces fast, long-range part slow)
+  void set_respa_switch(double, double);
+  // Reorder the particle arrays along a space-filling curve every n steps
+  // (0: never, the default), so that particles close in space are close in
+  // memory
+  void set_reorder(size_t, Curve = curve_hilbert);
+
   // Constructor
   // IN: number of dimensions, number of particles, mass (atomic units),
-  // initial temperature, density, boundaries, interaction model
-  // Uniform dist positions, normal dist velocities
-  NewtonSys(size_t, size_t, double, double, double, Bound, Model);
+  // initial temperature, density, boundaries, interaction model, initial
+  // placement, jitter (fraction of the mean spacing), minimum distance
+  // for random placement, seed (0: random_seed())
+  // Uniform dist or lattice positions, normal dist velocities
+  NewtonSys(size_t, size_t, double, double, double, Bound, Model,
+            Lattice = lattice_random, double = 0, double = 0, unsigned = 0);
 
   // Getters
 
   // Number of dimensions
-  size_t dim(void);
+  size_t dim(void) const { return Dim ? Dim : _dim; }
   // Container size
   double size(size_t);
+  // Time
+  double time(void);
   // Number of particles
   size_t n_particles(void);
   // Particles mass
   double mass(void);
+  // Neighbour list skin
+  double skin(void);
+  // Number of neighbour list rebuilds
+  size_t n_rebuilds(void);
+  // Number of listed pairs (within cutoff + skin)
+  size_t n_pairs(void);
+  // Instrumentation counters (phase times with MOLDYN_PROFILE)
+  const Counters &counters(void) const { return _counters; }
+  void reset_counters(void) { _counters.reset(); }
+  // Number of threads for force evaluation
+  int n_threads(void);
+  // Particle arrays (storage order)
+  const Basic_Particle_Array<real> &particles(void);
+  // ID of the particle in each slot of the particle arrays: its index at
+  // construction, kept by reorderings (frames and published positions are
+  // in ID order)
+  const std::vector<size_t> &ids(void) const { return _ids; }
   // Kinetic energy
   double kinetic(void);
   // Potential energy
   double potential(void);
+  // Virial tensor component (sum on pairs of s_a F_b)
+  double virial(size_t, size_t);
+  // Pressure
+  double pressure(void);
 
   // Update
 
   // Advance time by dt using velocity-Verlet method
   void vverlet(double);
+  // Advance time by dt using reversible RESPA: slow forces kick at both
+  // ends, fast forces are integrated by velocity-Verlet in n steps of dt / n
+  void respa(double, size_t);
+  // Place the particles again (velocities kept) and recompute forces
+  // IN: lattice, jitter, minimum distance for random placement
+  void place(Lattice, double = 0, double = 0);
+  // Reorder the particle arrays along the curve now (the neighbour list is
+  // rebuilt on the next force evaluation)
+  void reorder(void);
+  // Evaluate forces, potential and virial again, even if cached
+  void evaluate(void) {
+    _fresh = false;
+    _refresh();
+  }
 
   // Output
 
   // Output to gnuplot interactive terminal
   void out_gnuplot(void);
+  // Publish positions to a live viewer, if a frame is due
+  void publish(Snapshot_Publisher &);
   // Debug
   void debug(void);
+
+  // Checkpoints
+
+  // Save the whole state to a file (atomically)
+  bool checkpoint(const std::string &);
+  // Restore a state saved by a system of the same dimensions and number of
+  // particles
+  bool restore(const std::string &);
 };
 
 // Newtonian System of particles
 
+/*    Particle arrays   */
+
+// Constructor
+template <typename Real>
+Basic_Particle_Array<Real>::Basic_Particle_Array(size_t dim, size_t n)
+    : _dim(dim), _n(n),
+      _stride((n + ALIGNMENT / sizeof(Real) - 1) / (ALIGNMENT / sizeof(Real)) *
+              (ALIGNMENT / sizeof(Real))),
+      _x(_dim * _stride), _v(_dim * _stride), _a(_dim * _stride) {}
+
+// Reorder the particles
+template <typename Real>
+void Basic_Particle_Array<Real>::permute(const size_t *order,
+                                         aligned_vector<Real> &buffer) {
+  permute_rows(_x, _dim, _stride, order, _n, buffer);
+  permute_rows(_v, _dim, _stride, order, _n, buffer);
+  permute_rows(_a, _dim, _stride, order, _n, buffer);
+}
+
+// Reorder a block of component rows
+template <typename Real>
+void permute_rows(aligned_vector<Real> &block, size_t dim, size_t stride,
+                  const size_t *order, size_t n,
+                  aligned_vector<Real> &buffer) {
+  size_t i, j;
+  buffer.resize(block.size());
+  for (i = 0; i < dim; i++) {
+    const Real *from = block.data() + i * stride;
+    Real *to = buffer.data() + i * stride;
+    for (j = 0; j < n; j++)
+      to[j] = from[order[j]];
+    // Padding as it was
+    std::copy(from + n, from + stride, to + n);
+  }
+  block.swap(buffer);
+}
+
+// Copy of particle j
+template <typename Real>
+Particle Basic_Particle_Array<Real>::particle(size_t j, double mass) const {
+  Particle part(_dim, mass);
+  for (size_t i = 0; i < _dim; i++) {
+    part.x[i] = x(j, i);
+    part.v[i] = v(j, i);
+    part.a[i] = a(j, i);
+  }
+  return part;
+}
+
+// Particle arrays
+
+/*    Pair rows   */
+
+// Generic row of pairs through the model radial force and potential
+template <size_t Dim, typename Model, typename Real, typename Calc>
+double pair_row(Model &model, const Basic_Pair_Data<Real, Calc> &d, size_t j,
+                const size_t *k, size_t m) {
+  size_t i, p;
+  const size_t dim = Dim ? Dim : d.dim;
+  double E_p = 0;
+  Dim_Vector<Dim> sv(dim);
+  for (p = 0; p < m; p++) {
+    double d2 = 0;
+    for (i = 0; i < dim; i++) {
+      sv[i] = d.x[i * d.stride + j] - d.x[i * d.stride + k[p]];
+      if (d.box) {
+        if (sv[i] > 0.5 * d.box[i])
+          sv[i] -= d.box[i];
+        else if (sv[i] < -0.5 * d.box[i])
+          sv[i] += d.box[i];
+      }
+      d2 += sv[i] * sv[i];
+    }
+    if (d2 >= d.cut2)
+      continue;
+    double k_a;
+    E_p += model.pair(d2, k_a);
+    k_a *= d.scale;
+    for (i = 0; i < dim; i++) {
+      d.acc[i * d.stride + j] += k_a * sv[i];
+      d.acc[i * d.stride + k[p]] -= k_a * sv[i];
+      for (size_t b = 0; b < dim; b++)
+        d.virial[i * dim + b] += k_a * sv[i] * sv[b];
+    }
+  }
+  return E_p;
+}
+
+// Share of a pair force in a part
+inline double part_weight(Force_Part part, double d2, double in2,
+                          double out2) {
+  if (part == part_all)
+    return 1;
+  double S = 1;
+  if (d2 >= out2)
+    S = 0;
+  else if (d2 > in2) {
+    // Smoothstep in r^2: continuous first derivative at both ends
+    const double x = (d2 - in2) / (out2 - in2);
+    S = 1 - x * x * (3 - 2 * x);
+  }
+  return part == part_fast ? S : 1 - S;
+}
+
+// Row of pairs weighted for a part
+template <size_t Dim, typename Model, typename Real, typename Calc>
+double switched_row(Model &model, const Basic_Pair_Data<Real, Calc> &d,
+                    size_t j, const size_t *k, size_t m, Force_Part part,
+                    double in2, double out2, bool skip_full) {
+  size_t i, p;
+  const size_t dim = Dim ? Dim : d.dim;
+  double E_p = 0;
+  Dim_Vector<Dim> sv(dim);
+  for (p = 0; p < m; p++) {
+    double d2 = 0;
+    for (i = 0; i < dim; i++) {
+      sv[i] = d.x[i * d.stride + j] - d.x[i * d.stride + k[p]];
+      if (d.box) {
+        if (sv[i] > 0.5 * d.box[i])
+          sv[i] -= d.box[i];
+        else if (sv[i] < -0.5 * d.box[i])
+          sv[i] += d.box[i];
+      }
+      d2 += sv[i] * sv[i];
+    }
+    if (d2 >= d.cut2)
+      continue;
+    const double w = part_weight(part, d2, in2, out2);
+    if (w == 0 || (skip_full && w == 1))
+      continue;
+    double k_a;
+    E_p += w * model.pair(d2, k_a);
+    k_a *= w * d.scale;
+    for (i = 0; i < dim; i++) {
+      d.acc[i * d.stride + j] += k_a * sv[i];
+      d.acc[i * d.stride + k[p]] -= k_a * sv[i];
+      for (size_t b = 0; b < dim; b++)
+        d.virial[i * dim + b] += k_a * sv[i] * sv[b];
+    }
+  }
+  return E_p;
+}
+
+// Pair rows
+
+/*    SIMD dispatch   */
+
+// Best instruction set supported by the running CPU
+Simd simd_level(void) {
+  static const Simd level = [] {
+    Simd best = simd_scalar;
+#ifdef MOLDYN_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      best = simd_avx2;
+    if (__builtin_cpu_supports("avx512f"))
+      best = simd_avx512;
+#endif
+    const char *env = std::getenv("MOLDYN_SIMD");
+    if (env && std::string(env) == "scalar")
+      best = simd_scalar;
+    else if (env && std::string(env) == "avx2" && best > simd_avx2)
+      best = simd_avx2;
+    return best;
+  }();
+  return level;
+}
+
+// SIMD dispatch
+
+/*    Initial placement   */
+
+// Constructor
+Lattice_Sites::Lattice_Sites(Lattice lattice, const std::vector<double> &size,
+                             size_t n)
+    : _n(n ? n : 1), _size(size), _n_cells(size.size()) {
+
+  // Dummy indices
+  size_t i;
+  const size_t dim = size.size();
+
+  try {
+    if ((lattice == lattice_hex && dim != 2) ||
+        ((lattice == lattice_bcc || lattice == lattice_fcc) && dim != 3))
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: lattice not available in " << dim
+              << "D, using a cubic lattice" << '\n';
+    lattice = lattice_cubic;
+  }
+
+  // Sites of a cell in units of the cell side, a quarter cell off the origin
+  switch (lattice) {
+  case lattice_bcc:
+    _basis = {{0.25, 0.25, 0.25}, {0.75, 0.75, 0.75}};
+    break;
+  case lattice_fcc:
+    _basis = {{0.25, 0.25, 0.25},
+              {0.75, 0.75, 0.25},
+              {0.75, 0.25, 0.75},
+              {0.25, 0.75, 0.75}};
+    break;
+  case lattice_hex:
+    // Rectangular cell of two rows, the second shifted by half a site
+    _basis = {{0.25, 0.25}, {0.75, 0.75}};
+    break;
+  default:
+    _basis = {std::vector<double>(dim, 0.5)};
+  }
+
+  // Cells along each side: enough for n sites, hexagonal cells sqrt(3)
+  // times taller than wide
+  const size_t n_basis = _basis.size();
+  const double n_min = std::ceil(double(_n) / n_basis);
+  if (lattice == lattice_hex) {
+    _n_cells[0] =
+        std::max(1.0, std::round(std::sqrt(n_min * std::sqrt(3.0))));
+    _n_cells[1] = std::max(1.0, std::ceil(n_min / _n_cells[0]));
+  } else {
+    const size_t m = std::max(1.0, std::ceil(std::pow(n_min, 1.0 / dim) -
+                                             1e-9));
+    for (i = 0; i < dim; i++)
+      _n_cells[i] = m;
+  }
+  _n_sites = n_basis;
+  for (i = 0; i < dim; i++)
+    _n_sites *= _n_cells[i];
+}
+
+// Site j of n
+void Lattice_Sites::site(size_t j, double *x) const {
+  const size_t n_basis = _basis.size();
+  const size_t site = j * _n_sites / _n;
+  size_t cell = site / n_basis;
+  const std::vector<double> &b = _basis[site % n_basis];
+  for (size_t i = 0; i < _size.size(); i++) {
+    x[i] = (cell % _n_cells[i] + b[i]) * _size[i] / _n_cells[i];
+    cell /= _n_cells[i];
+  }
+}
+
+// Initial placement
+
+/*    Space-filling curves    */
+
+// Position of a cell along a curve
+uint64_t curve_key(Curve curve, size_t dim, uint64_t *c, unsigned bits) {
+
+  // Dummy indices
+  size_t i;
+  uint64_t q;
+
+  // Hilbert: coordinates to the transposed index (J. Skilling, AIP Conf.
+  // Proc. 707, 381 (2004)), then interleaved as for Morton
+  if (curve == curve_hilbert && bits > 0) {
+    const uint64_t top = uint64_t(1) << (bits - 1);
+    // Inverse undo of the rotations and reflections
+    for (q = top; q > 1; q >>= 1)
+      for (i = 0; i < dim; i++)
+        if (c[i] & q)
+          c[0] ^= q - 1;
+        else {
+          const uint64_t t = (c[0] ^ c[i]) & (q - 1);
+          c[0] ^= t;
+          c[i] ^= t;
+        }
+    // Gray encode
+    for (i = 1; i < dim; i++)
+      c[i] ^= c[i - 1];
+    uint64_t t = 0;
+    for (q = top; q > 1; q >>= 1)
+      if (c[dim - 1] & q)
+        t ^= q - 1;
+    for (i = 0; i < dim; i++)
+      c[i] ^= t;
+  }
+
+  // Interleave, most significant bits first
+  uint64_t key = 0;
+  for (q = bits; q-- > 0;)
+    for (i = 0; i < dim; i++)
+      key = key << 1 | ((c[i] >> q) & 1);
+  return key;
+}
+
+// Space-filling curves
+
+/*    Cell list   */
+
+// Set up the grid
+void Cell_List::setup(const std::vector<double> &size, double cutoff,
+                      size_t n_particles, Bound bound) {
+
+  // Dummy indices
+  size_t i, c, n;
+
+  _dim = size.size();
+  _bound = bound;
+  _cutoff = cutoff;
+  _n_cells.assign(_dim, 1);
+  _inv_width.assign(_dim, 0);
+
+  // Cells at least one cutoff wide, but never (many) more cells than
+  // particles so that tiny cutoffs do not blow up memory
+  double max_cells =
+      std::max(1.0, std::floor(std::pow(double(n_particles), 1.0 / _dim)));
+  for (i = 0; i < _dim; i++) {
+    double fit = cutoff > 0 ? std::floor(size[i] / cutoff) : max_cells;
+    _n_cells[i] = size_t(std::max(1.0, std::min(fit, max_cells)));
+    _inv_width[i] = _n_cells[i] / size[i];
+  }
+  _n_total = 1;
+  for (i = 0; i < _dim; i++)
+    _n_total *= _n_cells[i];
+
+  // Neighbouring cells: offsets -1, 0, +1 along each dimension
+  std::vector<size_t> coord(_dim), offset(_dim);
+  _neighbor_start.assign(1, 0);
+  _neighbors.clear();
+  for (c = 0; c < _n_total; c++) {
+    // Cell coordinates
+    for (i = 0, n = c; i < _dim; i++) {
+      coord[i] = n % _n_cells[i];
+      n /= _n_cells[i];
+    }
+    size_t first = _neighbors.size();
+    // Loop on the 3^dim offsets
+    std::fill(offset.begin(), offset.end(), 0);
+    while (true) {
+      size_t neighbor = 0, scale = 1;
+      bool inside = true;
+      for (i = 0; i < _dim; i++) {
+        long m = long(coord[i]) + long(offset[i]) - 1;
+        long n_c = long(_n_cells[i]);
+        if (m < 0 || m >= n_c) {
+          if (_bound == periodic)
+            m = (m + n_c) % n_c;
+          else
+            inside = false;
+        }
+        neighbor += size_t(m) * scale;
+        scale *= _n_cells[i];
+      }
+      if (inside &&
+          std::find(_neighbors.begin() + first, _neighbors.end(), neighbor) ==
+              _neighbors.end())
+        _neighbors.push_back(neighbor);
+      // Next offset
+      for (i = 0; i < _dim && ++offset[i] == 3; i++)
+        offset[i] = 0;
+      if (i == _dim)
+        break;
+    }
+    _neighbor_start.push_back(_neighbors.size());
+  }
+}
+
+// Sort particles into cells
+template <typename Real>
+void Cell_List::build(const Basic_Particle_Array<Real> &particles) {
+
+  // Dummy indices
+  size_t i, j, c;
+  const size_t n = particles.size();
+
+  _cell_of.assign(n, 0);
+  _cell_particles.resize(n);
+  _cell_start.assign(_n_total + 1, 0);
+
+  // Cell of each particle, one component row at a time
+  size_t scale = 1;
+  for (i = 0; i < _dim; i++) {
+    const Real *x = particles.x(i);
+    const long n_c = long(_n_cells[i]);
+    for (j = 0; j < n; j++) {
+      long m = long(x[j] * _inv_width[i]);
+      m = m < 0 ? 0 : (m >= n_c ? n_c - 1 : m);
+      _cell_of[j] += size_t(m) * scale;
+    }
+    scale *= _n_cells[i];
+  }
+
+  // Counting sort
+  for (j = 0; j < n; j++)
+    _cell_start[_cell_of[j] + 1]++;
+  for (c = 0; c < _n_total; c++)
+    _cell_start[c + 1] += _cell_start[c];
+  _fill.assign(_cell_start.begin(), _cell_start.end() - 1);
+  for (j = 0; j < n; j++)
+    _cell_particles[_fill[_cell_of[j]]++] = j;
+}
+
+// Call f(j, k) once for every pair j < k in neighbouring cells
+template <typename F> void Cell_List::for_each_pair(F f) const {
+  for_each_pair(f, 0, _cell_particles.size());
+}
+
+// Same, restricted to the particles in a range of cell order
+template <typename F>
+void Cell_List::for_each_pair(F f, size_t begin, size_t end) const {
+  size_t m, p, q;
+  for (p = begin; p < end; p++) {
+    const size_t j = _cell_particles[p], c = _cell_of[j];
+    for (m = _neighbor_start[c]; m < _neighbor_start[c + 1]; m++) {
+      const size_t nc = _neighbors[m];
+      for (q = _cell_start[nc]; q < _cell_start[nc + 1]; q++) {
+        const size_t k = _cell_particles[q];
+        if (k > j)
+          f(j, k);
+      }
+    }
+  }
+}
+
+// Cell list
+
+/*    Neighbour list    */
+
+// Rebuild the list if needed
+template <typename Real>
+bool Neighbor_List::update(const Basic_Particle_Array<Real> &particles,
+                           const std::vector<double> &size, double cutoff,
+                           Bound bound) {
+
+  // No range: nothing to list
+  if (cutoff <= 0) {
+    _row_particle.clear();
+    _row_start.assign(1, 0);
+    _neighbors.clear();
+    _all_pairs = _valid = false;
+    return false;
+  }
+
+  // Infinite range: no list, every pair is a candidate
+  if (std::isinf(cutoff)) {
+    if (!_all_pairs || _cells.cutoff() != cutoff)
+      _cells.setup(size, cutoff, particles.size(), bound);
+    _cells.build(particles);
+    _all_pairs = true;
+    return false;
+  }
+  _all_pairs = false;
+
+  // Grid for the new range
+  if (_cells.cutoff() != cutoff + _skin) {
+    _cells.setup(size, cutoff + _skin, particles.size(), bound);
+    _valid = false;
+  }
+
+  if (_valid && 4 * _max_disp2(particles, size, bound) <= _skin * _skin)
+    return false;
+
+  _build(particles, size, bound);
+  return true;
+}
+
+// Build the list from the current positions
+template <typename Real>
+void Neighbor_List::_build(const Basic_Particle_Array<Real> &particles,
+                           const std::vector<double> &size, Bound bound) {
+
+  const size_t dim = particles.dim(), stride = particles.stride();
+  const double range = _cells.cutoff(), range2 = range * range;
+
+  _row_particle.clear();
+  _row_start.assign(1, 0);
+  _neighbors.clear();
+
+  // Candidate pairs from neighbouring cells; all pairs of a given j come
+  // out consecutively, so each j becomes one row
+  _cells.build(particles);
+  _cells.for_each_pair([&](size_t j, size_t k) {
+    double d2 = 0;
+    for (size_t i = 0; i < dim; i++) {
+      double s = particles.x(j, i) - particles.x(k, i);
+      if (bound == periodic) {
+        if (s > 0.5 * size[i])
+          s -= size[i];
+        else if (s < -0.5 * size[i])
+          s += size[i];
+      }
+      d2 += s * s;
+    }
+    if (d2 >= range2)
+      return;
+    if (_row_particle.empty() || _row_particle.back() != j) {
+      _row_start.push_back(_neighbors.size());
+      _row_particle.push_back(j);
+    }
+    _neighbors.push_back(k);
+    _row_start.back() = _neighbors.size();
+  });
+
+  // Reference positions
+  _x_ref.assign(particles.x(0), particles.x(0) + dim * stride);
+
+  _valid = true;
+  _rebuilds++;
+}
+
+// Largest squared displacement since the last build
+template <typename Real>
+double Neighbor_List::_max_disp2(const Basic_Particle_Array<Real> &particles,
+                                 const std::vector<double> &size,
+                                 Bound bound) {
+  size_t i, j;
+  const size_t n = particles.size(), stride = particles.stride();
+  double max = 0;
+
+  _disp2.assign(n, 0);
+  for (i = 0; i < particles.dim(); i++) {
+    const Real *x = particles.x(i);
+    const double *x_ref = _x_ref.data() + i * stride;
+    const double L = size[i];
+    for (j = 0; j < n; j++) {
+      double s = x[j] - x_ref[j];
+      if (bound == periodic) {
+        if (s > 0.5 * L)
+          s -= L;
+        else if (s < -0.5 * L)
+          s += L;
+      }
+      _disp2[j] += s * s;
+    }
+  }
+  for (j = 0; j < n; j++)
+    max = std::max(max, _disp2[j]);
+  return max;
+}
+
+// Call f(j, k) once for every listed pair
+template <typename F> void Neighbor_List::for_each_pair(F f) const {
+  for_each_pair(f, 0, n_rows());
+}
+
+// Same, restricted to a range of rows
+template <typename F>
+void Neighbor_List::for_each_pair(F f, size_t begin, size_t end) const {
+  if (_all_pairs) {
+    _cells.for_each_pair(f, begin, end);
+    return;
+  }
+  for (size_t r = begin; r < end; r++) {
+    const size_t j = _row_particle[r];
+    for (size_t m = _row_start[r]; m < _row_start[r + 1]; m++)
+      f(j, _neighbors[m]);
+  }
+}
+
+// Call f(j, k, m) for every listed row in a range: j against k[0..m)
+template <typename F>
+void Neighbor_List::for_each_row(F f, size_t begin, size_t end) const {
+  for (size_t r = begin; r < end; r++)
+    f(_row_particle[r], _neighbors.data() + _row_start[r],
+      _row_start[r + 1] - _row_start[r]);
+}
+
+// Neighbour list
+
 /*    Lennard-Jones model   */
 
 // Name
 const std::string Lennard_Jones::name = "Lennard-Jones";
 
 // Set parameters
-void Lennard_Jones::set_epsilon(double epsilon) { _epsilon = epsilon; }
+void Lennard_Jones::set_epsilon(double epsilon) {
+  _epsilon = epsilon;
+  _update_shift();
+}
 void Lennard_Jones::set_sigma(double sigma) {
-  _sigma6 = std::pow(sigma, 6);
-  _sigma12 = std::pow(sigma, 12);
-  _sigma8 = std::pow(sigma, 8);
-  _sigma14 = std::pow(sigma, 14);
+  _sigma = sigma;
+  _sigma2 = sigma * sigma;
+  _update_shift();
+}
+void Lennard_Jones::set_cutoff(double r_cut) {
+  _r_cut = r_cut;
+  _update_shift();
+}
+
+// Energy at the cutoff: (1/r_cut)^6 in units of sigma
+void Lennard_Jones::_update_shift(void) {
+  _shift = 0;
+  if (std::isfinite(_r_cut) && _r_cut > 0) {
+    const double rc2 = _r_cut * _r_cut, sr6 = 1 / (rc2 * rc2 * rc2);
+    _shift = 4 * _epsilon * sr6 * (sr6 - 1);
+  }
 }
 
 // Lennard-Jones potential energy on a given distance squared
-double Lennard_Jones::potential(double d2) {
-  return (4 * _epsilon *
-          ((_sigma12 / std::pow(d2, 6)) - (_sigma6 / std::pow(d2, 3))));
+double Lennard_Jones::potential(double d2) const {
+  double sr2 = _sigma2 / d2, sr6 = sr2 * sr2 * sr2;
+  return (4 * _epsilon * sr6 * (sr6 - 1) - _shift);
 }
 
 // Potential
 
 // Lennard-Jones potential energy for a given separation vector
-double Lennard_Jones::potential(std::vector<double> &s) {
-  // Number of dimensions
-  size_t dim = s.size();
-  // Dummy indices
-  size_t i;
+double Lennard_Jones::potential(const double *s, size_t dim) const {
   // Distance
   double d2 = 0;
   // Calculate distance
-  for (i = 0; i < dim; i++)
-    d2 += std::pow(s[i], 2);
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
   // Calculate energy
   return (potential(d2));
 }
 
 // Lennard-Jones potential energy of particle1 due to particle1
-double Lennard_Jones::potential(Particle part1, Particle part2) {
-  // Number of dimensions
-  size_t dim = part1.dim;
-  // Dummy indices
-  size_t i;
+double Lennard_Jones::potential(const Particle &part1,
+                                const Particle &part2) const {
   // Distance
   double d2 = 0;
-
   // Calculate distance
-  for (i = 0; i < dim; i++)
-    d2 += std::pow(part1.x[i] - part2.x[i], 2);
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
   // Calculate energy
   return (potential(d2));
 }
@@ -218,63 +1539,600 @@ double Lennard_Jones::potential(Particle part1, Particle part2) {
 // Force
 
 // Lennard-Jones force modulus for a given distance squared
-double Lennard_Jones::k_force(double d2) {
-  return (48 * _epsilon *
-          ((_sigma14 / std::pow(d2, 7)) - 0.5 * (_sigma8 / std::pow(d2, 4))));
+double Lennard_Jones::k_force(double d2) const {
+  double sr2 = _sigma2 / d2, sr6 = sr2 * sr2 * sr2;
+  return (48 * _epsilon * sr6 * (sr6 - 0.5) / d2);
 }
 
 // Lennard-Jones force for a given separation vector
-std::vector<double> Lennard_Jones::force(std::vector<double> &s) {
+void Lennard_Jones::force(const double *s, size_t dim, double *F) const {
+  // Dummy indices
+  size_t i;
+  // Distance
+  double d2 = 0;
+  // Calculate distance
+  for (i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  // Calculate multiplier
+  double k = k_force(d2);
+  // Calculate force
+  for (i = 0; i < dim; i++)
+    F[i] = k * s[i];
+}
 
-  // Number of dimensions
-  size_t dim = s.size();
-  // Dummy variables
-  size_t i, j;
+// Lennard-Jones force on particle1 due to particle2
+void Lennard_Jones::force(const Particle &part1, const Particle &part2,
+                          double *F) const {
+  // Dummy indices
+  size_t i;
   // Distance
   double d2 = 0;
-  // Potential constant
-  double k;
-  // Force
-  std::vector<double> F(dim);
+  // Calculate distance, keep separation in F
+  for (i = 0; i < part1.dim; i++) {
+    F[i] = part1.x[i] - part2.x[i];
+    d2 += F[i] * F[i];
+  }
+  // Calculate multiplier
+  double k = k_force(d2);
+  // Calculate force
+  for (i = 0; i < part1.dim; i++)
+    F[i] *= k;
+}
+
+// Lennard-Jones force multiplier and potential energy
+double Lennard_Jones::pair(double d2, double &k) const {
+  double sr2 = _sigma2 / d2, sr6 = sr2 * sr2 * sr2;
+  k = 48 * _epsilon * sr6 * (sr6 - 0.5) / d2;
+  return 4 * _epsilon * sr6 * (sr6 - 1) - _shift;
+}
+
+// Pair kernels
+
+// Kernels are instantiated for Dim = 2 and 3
+
+// Scalar Lennard-Jones row: separations in the storage precision, then
+// pair arithmetic in Calc
+// IN: 4 epsilon, sigma^2, energy shift, pair data, j, partners, number of
+// partners
+template <size_t Dim, typename Real, typename Calc>
+double lj_row_scalar(double eps4_, double sigma2_, double shift_,
+                     const Basic_Pair_Data<Real, Calc> &d, size_t j,
+                     const size_t *k, size_t m) {
+  size_t i, p;
+  const Calc eps4 = Calc(eps4_), sigma2 = Calc(sigma2_), cut2 = Calc(d.cut2),
+             scale = Calc(d.scale), shift = Calc(shift_);
+  Real s_r;
+  Calc s[Dim];
+  double E_p = 0;
+  for (p = 0; p < m; p++) {
+    Calc d2 = 0;
+    for (i = 0; i < Dim; i++) {
+      s_r = d.x[i * d.stride + j] - d.x[i * d.stride + k[p]];
+      if (d.box) {
+        if (s_r > 0.5 * d.box[i])
+          s_r -= d.box[i];
+        else if (s_r < -0.5 * d.box[i])
+          s_r += d.box[i];
+      }
+      s[i] = Calc(s_r);
+      d2 += s[i] * s[i];
+    }
+    if (d2 >= cut2)
+      continue;
+    Calc inv = 1 / d2, sr2 = sigma2 * inv, sr6 = sr2 * sr2 * sr2;
+    Calc k_a = 12 * eps4 * inv * sr6 * (sr6 - Calc(0.5)) * scale;
+    for (i = 0; i < Dim; i++) {
+      d.acc[i * d.stride + j] += k_a * s[i];
+      d.acc[i * d.stride + k[p]] -= k_a * s[i];
+      for (size_t b = 0; b < Dim; b++)
+        d.virial[i * Dim + b] += k_a * s[i] * s[b];
+    }
+    E_p += eps4 * sr6 * (sr6 - 1) - shift;
+  }
+  return E_p;
+}
+
+#ifdef MOLDYN_X86_SIMD
+
+// AVX2 Lennard-Jones row: 4 pairs at a time, padded tail
+// (no calls into non-VEX code, which would stall on the AVX/SSE transition)
+template <size_t Dim>
+__attribute__((target("avx2,fma"))) double
+lj_row_avx2(double eps4, double sigma2, double shift, const Pair_Data &d,
+            size_t j, const size_t *k, size_t m) {
+
+  size_t i, p, l;
+  const size_t dim = Dim, stride = d.stride;
+  __m256d xj[Dim], box[Dim], half[Dim], f_j[Dim], s[Dim], w[Dim * Dim];
+  const __m256d cut2 = _mm256_set1_pd(d.cut2), sig2 = _mm256_set1_pd(sigma2),
+                c_f = _mm256_set1_pd(12 * eps4 * d.scale),
+                c_u = _mm256_set1_pd(eps4), c_s = _mm256_set1_pd(shift),
+                one = _mm256_set1_pd(1), c_half = _mm256_set1_pd(0.5);
+  const __m256d lane_id = _mm256_set_pd(3, 2, 1, 0);
+  __m256d E_p = _mm256_setzero_pd();
+  alignas(32) double f_k[4];
+  size_t k4[4];
+
+  for (i = 0; i < dim * dim; i++)
+    w[i] = _mm256_setzero_pd();
+  for (i = 0; i < dim; i++) {
+    xj[i] = _mm256_set1_pd(d.x[i * stride + j]);
+    f_j[i] = _mm256_setzero_pd();
+    if (d.box) {
+      box[i] = _mm256_set1_pd(d.box[i]);
+      half[i] = _mm256_set1_pd(0.5 * d.box[i]);
+    }
+  }
+
+  for (p = 0; p < m; p += 4) {
+    // Partners, the last one repeated past the end of the row
+    const size_t n_live = std::min(m - p, size_t(4));
+    for (l = 0; l < 4; l++)
+      k4[l] = k[p + std::min(l, n_live - 1)];
+    // Separation and squared distance
+    __m256d d2 = _mm256_setzero_pd();
+    for (i = 0; i < dim; i++) {
+      const double *x = d.x + i * stride;
+      __m256d xk = _mm256_set_pd(x[k4[3]], x[k4[2]], x[k4[1]], x[k4[0]]);
+      s[i] = _mm256_sub_pd(xj[i], xk);
+      if (d.box) {
+        __m256d hi = _mm256_cmp_pd(s[i], half[i], _CMP_GT_OQ);
+        __m256d lo = _mm256_cmp_pd(
+            s[i], _mm256_sub_pd(_mm256_setzero_pd(), half[i]), _CMP_LT_OQ);
+        s[i] = _mm256_sub_pd(s[i], _mm256_and_pd(hi, box[i]));
+        s[i] = _mm256_add_pd(s[i], _mm256_and_pd(lo, box[i]));
+      }
+      d2 = _mm256_fmadd_pd(s[i], s[i], d2);
+    }
+    // r^-2, (sigma/r)^6 and (sigma/r)^12 by multiplication
+    const __m256d in = _mm256_and_pd(
+        _mm256_cmp_pd(d2, cut2, _CMP_LT_OQ),
+        _mm256_cmp_pd(lane_id, _mm256_set1_pd(double(n_live)), _CMP_LT_OQ));
+    const __m256d inv = _mm256_div_pd(one, d2);
+    const __m256d sr2 = _mm256_mul_pd(sig2, inv);
+    const __m256d sr6 = _mm256_mul_pd(_mm256_mul_pd(sr2, sr2), sr2);
+    const __m256d k_a = _mm256_and_pd(
+        in, _mm256_mul_pd(_mm256_mul_pd(c_f, inv),
+                          _mm256_mul_pd(sr6, _mm256_sub_pd(sr6, c_half))));
+    E_p = _mm256_add_pd(
+        E_p, _mm256_and_pd(in, _mm256_fmsub_pd(_mm256_mul_pd(c_u, sr6),
+                                               _mm256_sub_pd(sr6, one), c_s)));
+    // Accumulate on j and the virial, scatter to partners
+    for (i = 0; i < dim; i++) {
+      const __m256d f = _mm256_mul_pd(k_a, s[i]);
+      f_j[i] = _mm256_add_pd(f_j[i], f);
+      for (l = 0; l < dim; l++)
+        w[i * dim + l] = _mm256_fmadd_pd(f, s[l], w[i * dim + l]);
+      _mm256_store_pd(f_k, f);
+      double *acc = d.acc + i * stride;
+      for (l = 0; l < n_live; l++)
+        acc[k4[l]] -= f_k[l];
+    }
+  }
+
+  // Horizontal sums
+  alignas(32) double lane[4];
+  for (i = 0; i < dim; i++) {
+    _mm256_store_pd(lane, f_j[i]);
+    d.acc[i * stride + j] += (lane[0] + lane[1]) + (lane[2] + lane[3]);
+  }
+  for (i = 0; i < dim * dim; i++) {
+    _mm256_store_pd(lane, w[i]);
+    d.virial[i] += (lane[0] + lane[1]) + (lane[2] + lane[3]);
+  }
+  _mm256_store_pd(lane, E_p);
+  return (lane[0] + lane[1]) + (lane[2] + lane[3]);
+}
+
+// AVX-512 Lennard-Jones row: 8 pairs at a time, masked tail
+template <size_t Dim>
+__attribute__((target("avx512f"))) double
+lj_row_avx512(double eps4, double sigma2, double shift, const Pair_Data &d,
+              size_t j, const size_t *k, size_t m) {
+
+  size_t i, p;
+  const size_t dim = Dim, stride = d.stride;
+  __m512d xj[Dim], box[Dim], half[Dim], neg_half[Dim], f_j[Dim], s[Dim],
+      w[Dim * Dim];
+  const __m512d cut2 = _mm512_set1_pd(d.cut2), sig2 = _mm512_set1_pd(sigma2),
+                c_f = _mm512_set1_pd(12 * eps4 * d.scale),
+                c_u = _mm512_set1_pd(eps4), c_s = _mm512_set1_pd(shift),
+                one = _mm512_set1_pd(1), c_half = _mm512_set1_pd(0.5);
+  __m512d E_p = _mm512_setzero_pd();
+
+  for (i = 0; i < dim * dim; i++)
+    w[i] = _mm512_setzero_pd();
+  for (i = 0; i < dim; i++) {
+    xj[i] = _mm512_set1_pd(d.x[i * stride + j]);
+    f_j[i] = _mm512_setzero_pd();
+    if (d.box) {
+      box[i] = _mm512_set1_pd(d.box[i]);
+      half[i] = _mm512_set1_pd(0.5 * d.box[i]);
+      neg_half[i] = _mm512_set1_pd(-0.5 * d.box[i]);
+    }
+  }
+
+  for (p = 0; p < m; p += 8) {
+    // Lanes holding a partner
+    const __mmask8 live = m - p >= 8 ? 0xff : __mmask8((1u << (m - p)) - 1);
+    const __m512i idx = _mm512_maskz_loadu_epi64(live, k + p);
+    // Separation and squared distance
+    __m512d d2 = _mm512_setzero_pd();
+    for (i = 0; i < dim; i++) {
+      __m512d xk = _mm512_mask_i64gather_pd(xj[i], live, idx,
+                                            d.x + i * stride, 8);
+      s[i] = _mm512_sub_pd(xj[i], xk);
+      if (d.box) {
+        __mmask8 hi = _mm512_cmp_pd_mask(s[i], half[i], _CMP_GT_OQ);
+        __mmask8 lo = _mm512_cmp_pd_mask(s[i], neg_half[i], _CMP_LT_OQ);
+        s[i] = _mm512_mask_sub_pd(s[i], hi, s[i], box[i]);
+        s[i] = _mm512_mask_add_pd(s[i], lo, s[i], box[i]);
+      }
+      d2 = _mm512_fmadd_pd(s[i], s[i], d2);
+    }
+    // r^-2, (sigma/r)^6 and (sigma/r)^12 by multiplication
+    const __mmask8 in = live & _mm512_cmp_pd_mask(d2, cut2, _CMP_LT_OQ);
+    const __m512d inv = _mm512_maskz_div_pd(in, one, d2);
+    const __m512d sr2 = _mm512_mul_pd(sig2, inv);
+    const __m512d sr6 = _mm512_mul_pd(_mm512_mul_pd(sr2, sr2), sr2);
+    const __m512d k_a =
+        _mm512_mul_pd(_mm512_mul_pd(c_f, inv),
+                      _mm512_mul_pd(sr6, _mm512_sub_pd(sr6, c_half)));
+    E_p = _mm512_mask_add_pd(E_p, in, E_p,
+                             _mm512_fmsub_pd(_mm512_mul_pd(c_u, sr6),
+                                             _mm512_sub_pd(sr6, one), c_s));
+    // Accumulate on j and the virial, scatter to partners (distinct within
+    // a row)
+    for (i = 0; i < dim; i++) {
+      const __m512d f = _mm512_maskz_mul_pd(in, k_a, s[i]);
+      f_j[i] = _mm512_add_pd(f_j[i], f);
+      for (size_t b = 0; b < dim; b++)
+        w[i * dim + b] = _mm512_fmadd_pd(f, s[b], w[i * dim + b]);
+      double *acc = d.acc + i * stride;
+      __m512d a_k = _mm512_mask_i64gather_pd(f, in, idx, acc, 8);
+      _mm512_mask_i64scatter_pd(acc, in, idx, _mm512_sub_pd(a_k, f), 8);
+    }
+  }
+
+  // Horizontal sums
+  alignas(64) double lane[8];
+  for (i = 0; i < dim; i++) {
+    _mm512_store_pd(lane, f_j[i]);
+    d.acc[i * stride + j] += ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+                             ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+  }
+  for (i = 0; i < dim * dim; i++) {
+    _mm512_store_pd(lane, w[i]);
+    d.virial[i] += ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+                   ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+  }
+  _mm512_store_pd(lane, E_p);
+  return ((lane[0] + lane[1]) + (lane[2] + lane[3])) +
+         ((lane[4] + lane[5]) + (lane[6] + lane[7]));
+}
+
+// Single precision kernels: separations are taken in the storage precision
+// (minimum image included), then converted to float
+
+// AVX2 float Lennard-Jones row: 8 pairs at a time, padded tail
+template <size_t Dim, typename Real>
+__attribute__((target("avx2,fma"))) double
+lj_row_avx2_ps(double eps4, double sigma2, double shift,
+               const Basic_Pair_Data<Real, float> &d, size_t j,
+               const size_t *k, size_t m) {
+
+  size_t i, p, l;
+  const size_t dim = Dim, stride = d.stride;
+  Real xj[Dim], box[Dim], half[Dim];
+  __m256 f_j[Dim], s[Dim], w[Dim * Dim];
+  const __m256 cut2 = _mm256_set1_ps(float(d.cut2)),
+               sig2 = _mm256_set1_ps(float(sigma2)),
+               c_f = _mm256_set1_ps(float(12 * eps4 * d.scale)),
+               c_u = _mm256_set1_ps(float(eps4)),
+               c_s = _mm256_set1_ps(float(shift)), one = _mm256_set1_ps(1),
+               c_half = _mm256_set1_ps(0.5f);
+  const __m256 lane_id = _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0);
+  __m256 E_p = _mm256_setzero_ps();
+  alignas(32) float s_k[8], f_k[8];
+  size_t k8[8];
+
+  for (i = 0; i < dim * dim; i++)
+    w[i] = _mm256_setzero_ps();
+  for (i = 0; i < dim; i++) {
+    xj[i] = d.x[i * stride + j];
+    f_j[i] = _mm256_setzero_ps();
+    if (d.box) {
+      box[i] = Real(d.box[i]);
+      half[i] = Real(0.5 * d.box[i]);
+    }
+  }
+
+  for (p = 0; p < m; p += 8) {
+    // Partners, the last one repeated past the end of the row
+    const size_t n_live = std::min(m - p, size_t(8));
+    for (l = 0; l < 8; l++)
+      k8[l] = k[p + std::min(l, n_live - 1)];
+    // Separation and squared distance
+    __m256 d2 = _mm256_setzero_ps();
+    for (i = 0; i < dim; i++) {
+      const Real *x = d.x + i * stride;
+      for (l = 0; l < 8; l++) {
+        Real s_r = xj[i] - x[k8[l]];
+        if (d.box) {
+          if (s_r > half[i])
+            s_r -= box[i];
+          else if (s_r < -half[i])
+            s_r += box[i];
+        }
+        s_k[l] = float(s_r);
+      }
+      s[i] = _mm256_load_ps(s_k);
+      d2 = _mm256_fmadd_ps(s[i], s[i], d2);
+    }
+    // r^-2, (sigma/r)^6 and (sigma/r)^12 by multiplication
+    const __m256 in = _mm256_and_ps(
+        _mm256_cmp_ps(d2, cut2, _CMP_LT_OQ),
+        _mm256_cmp_ps(lane_id, _mm256_set1_ps(float(n_live)), _CMP_LT_OQ));
+    const __m256 inv = _mm256_div_ps(one, d2);
+    const __m256 sr2 = _mm256_mul_ps(sig2, inv);
+    const __m256 sr6 = _mm256_mul_ps(_mm256_mul_ps(sr2, sr2), sr2);
+    const __m256 k_a = _mm256_and_ps(
+        in, _mm256_mul_ps(_mm256_mul_ps(c_f, inv),
+                          _mm256_mul_ps(sr6, _mm256_sub_ps(sr6, c_half))));
+    E_p = _mm256_add_ps(
+        E_p, _mm256_and_ps(in, _mm256_fmsub_ps(_mm256_mul_ps(c_u, sr6),
+                                               _mm256_sub_ps(sr6, one), c_s)));
+    // Accumulate on j and the virial, scatter to partners
+    for (i = 0; i < dim; i++) {
+      const __m256 f = _mm256_mul_ps(k_a, s[i]);
+      f_j[i] = _mm256_add_ps(f_j[i], f);
+      for (l = 0; l < dim; l++)
+        w[i * dim + l] = _mm256_fmadd_ps(f, s[l], w[i * dim + l]);
+      _mm256_store_ps(f_k, f);
+      Real *acc = d.acc + i * stride;
+      for (l = 0; l < n_live; l++)
+        acc[k8[l]] -= f_k[l];
+    }
+  }
 
-  // Calculate distance
-  for (i = 0; i < dim; i++)
-    d2 += std::pow(s[i], 2);
+  // Horizontal sums, in double
+  alignas(32) float lane[8];
+  double sum;
+  for (i = 0; i < dim; i++) {
+    _mm256_store_ps(lane, f_j[i]);
+    for (l = 0, sum = 0; l < 8; l++)
+      sum += lane[l];
+    d.acc[i * stride + j] += sum;
+  }
+  for (i = 0; i < dim * dim; i++) {
+    _mm256_store_ps(lane, w[i]);
+    for (l = 0, sum = 0; l < 8; l++)
+      sum += lane[l];
+    d.virial[i] += sum;
+  }
+  _mm256_store_ps(lane, E_p);
+  for (l = 0, sum = 0; l < 8; l++)
+    sum += lane[l];
+  return sum;
+}
 
-  // Calculate multiplier
-  k = k_force(d2);
-  // Calculate force
-  for (i = 0; i < dim; i++)
-    F[i] = k * s[i];
-  return F;
+// Halves of a 16 float vector, and conversions of 8 lanes (zero-masked
+// forms: the plain ones leave lanes undefined, which compilers warn about)
+__attribute__((target("avx512f"))) inline __m512 join_ps(__m256 lo,
+                                                         __m256 hi) {
+  return _mm512_castpd_ps(_mm512_maskz_insertf64x4(
+      0xff, _mm512_castps_pd(_mm512_castps256_ps512(lo)),
+      _mm256_castps_pd(hi), 1));
+}
+__attribute__((target("avx512f"))) inline __m256 low_ps(__m512 v) {
+  return _mm256_castpd_ps(
+      _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 0));
+}
+__attribute__((target("avx512f"))) inline __m256 high_ps(__m512 v) {
+  return _mm256_castpd_ps(
+      _mm512_maskz_extractf64x4_pd(0xf, _mm512_castps_pd(v), 1));
+}
+__attribute__((target("avx512f"))) inline __m256 narrow_ps(__m512d v) {
+  return _mm512_maskz_cvtpd_ps(0xff, v);
+}
+__attribute__((target("avx512f"))) inline __m512d widen_pd(__m256 v) {
+  return _mm512_maskz_cvtps_pd(0xff, v);
 }
 
-// Lennard-Jones force on particle1 due to particle2
-std::vector<double> Lennard_Jones::force(Particle part1, Particle part2) {
+// AVX-512 float Lennard-Jones row: 16 pairs at a time (two halves of 8
+// indices), masked tail
+template <size_t Dim, typename Real>
+__attribute__((target("avx512f"))) double
+lj_row_avx512_ps(double eps4, double sigma2, double shift,
+                 const Basic_Pair_Data<Real, float> &d, size_t j,
+                 const size_t *k, size_t m) {
+
+  size_t i, p, l;
+  const size_t dim = Dim, stride = d.stride;
+  constexpr bool wide = std::is_same<Real, double>::value;
+  // Own position and box, in the storage precision
+  __m512d xj_d[Dim], box_d[Dim], half_d[Dim], neg_half_d[Dim];
+  __m512 xj_f[Dim], box_f[Dim], half_f[Dim], neg_half_f[Dim];
+  __m512 f_j[Dim], s[Dim], w[Dim * Dim];
+  const __m512 cut2 = _mm512_set1_ps(float(d.cut2)),
+               sig2 = _mm512_set1_ps(float(sigma2)),
+               c_f = _mm512_set1_ps(float(12 * eps4 * d.scale)),
+               c_u = _mm512_set1_ps(float(eps4)),
+               c_s = _mm512_set1_ps(float(shift)), one = _mm512_set1_ps(1),
+               c_half = _mm512_set1_ps(0.5f);
+  __m512 E_p = _mm512_setzero_ps();
+
+  for (i = 0; i < dim * dim; i++)
+    w[i] = _mm512_setzero_ps();
+  for (i = 0; i < dim; i++) {
+    f_j[i] = _mm512_setzero_ps();
+    if constexpr (wide) {
+      xj_d[i] = _mm512_set1_pd(d.x[i * stride + j]);
+      if (d.box) {
+        box_d[i] = _mm512_set1_pd(d.box[i]);
+        half_d[i] = _mm512_set1_pd(0.5 * d.box[i]);
+        neg_half_d[i] = _mm512_set1_pd(-0.5 * d.box[i]);
+      }
+    } else {
+      xj_f[i] = _mm512_set1_ps(d.x[i * stride + j]);
+      if (d.box) {
+        box_f[i] = _mm512_set1_ps(float(d.box[i]));
+        half_f[i] = _mm512_set1_ps(float(0.5 * d.box[i]));
+        neg_half_f[i] = _mm512_set1_ps(float(-0.5 * d.box[i]));
+      }
+    }
+  }
 
-  // Number of dimensions
-  size_t dim = part1.dim;
-  // Dummy variables
-  size_t i, j;
-  // Separation vector and distance
-  std::vector<double> s(dim);
-  double d2 = 0;
-  // Potential constant
-  double k;
-  // Forces
-  std::vector<double> F(dim);
+  for (p = 0; p < m; p += 16) {
+    // Lanes holding a partner
+    const __mmask16 live =
+        m - p >= 16 ? 0xffff : __mmask16((1u << (m - p)) - 1);
+    const __mmask8 live_lo = __mmask8(live), live_hi = __mmask8(live >> 8);
+    const __m512i idx_lo = _mm512_maskz_loadu_epi64(live_lo, k + p);
+    const __m512i idx_hi = _mm512_maskz_loadu_epi64(live_hi, k + p + 8);
+    // Separation and squared distance
+    __m512 d2 = _mm512_setzero_ps();
+    for (i = 0; i < dim; i++) {
+      const Real *x = d.x + i * stride;
+      if constexpr (wide) {
+        __m512d s_h[2];
+        s_h[0] = _mm512_sub_pd(
+            xj_d[i], _mm512_mask_i64gather_pd(xj_d[i], live_lo, idx_lo, x, 8));
+        s_h[1] = _mm512_sub_pd(
+            xj_d[i], _mm512_mask_i64gather_pd(xj_d[i], live_hi, idx_hi, x, 8));
+        for (l = 0; l < 2 && d.box; l++) {
+          __mmask8 hi = _mm512_cmp_pd_mask(s_h[l], half_d[i], _CMP_GT_OQ);
+          __mmask8 lo = _mm512_cmp_pd_mask(s_h[l], neg_half_d[i], _CMP_LT_OQ);
+          s_h[l] = _mm512_mask_sub_pd(s_h[l], hi, s_h[l], box_d[i]);
+          s_h[l] = _mm512_mask_add_pd(s_h[l], lo, s_h[l], box_d[i]);
+        }
+        s[i] = join_ps(narrow_ps(s_h[0]), narrow_ps(s_h[1]));
+      } else {
+        const __m256 xj_h = low_ps(xj_f[i]);
+        s[i] = _mm512_sub_ps(
+            xj_f[i],
+            join_ps(_mm512_mask_i64gather_ps(xj_h, live_lo, idx_lo, x, 4),
+                    _mm512_mask_i64gather_ps(xj_h, live_hi, idx_hi, x, 4)));
+        if (d.box) {
+          __mmask16 hi = _mm512_cmp_ps_mask(s[i], half_f[i], _CMP_GT_OQ);
+          __mmask16 lo = _mm512_cmp_ps_mask(s[i], neg_half_f[i], _CMP_LT_OQ);
+          s[i] = _mm512_mask_sub_ps(s[i], hi, s[i], box_f[i]);
+          s[i] = _mm512_mask_add_ps(s[i], lo, s[i], box_f[i]);
+        }
+      }
+      d2 = _mm512_fmadd_ps(s[i], s[i], d2);
+    }
+    // r^-2, (sigma/r)^6 and (sigma/r)^12 by multiplication
+    const __mmask16 in = live & _mm512_cmp_ps_mask(d2, cut2, _CMP_LT_OQ);
+    const __mmask8 in_lo = __mmask8(in), in_hi = __mmask8(in >> 8);
+    const __m512 inv = _mm512_maskz_div_ps(in, one, d2);
+    const __m512 sr2 = _mm512_mul_ps(sig2, inv);
+    const __m512 sr6 = _mm512_mul_ps(_mm512_mul_ps(sr2, sr2), sr2);
+    const __m512 k_a =
+        _mm512_mul_ps(_mm512_mul_ps(c_f, inv),
+                      _mm512_mul_ps(sr6, _mm512_sub_ps(sr6, c_half)));
+    E_p = _mm512_mask_add_ps(E_p, in, E_p,
+                             _mm512_fmsub_ps(_mm512_mul_ps(c_u, sr6),
+                                             _mm512_sub_ps(sr6, one), c_s));
+    // Accumulate on j and the virial, scatter to partners (distinct within
+    // a row)
+    for (i = 0; i < dim; i++) {
+      const __m512 f = _mm512_maskz_mul_ps(in, k_a, s[i]);
+      f_j[i] = _mm512_add_ps(f_j[i], f);
+      for (size_t b = 0; b < dim; b++)
+        w[i * dim + b] = _mm512_fmadd_ps(f, s[b], w[i * dim + b]);
+      Real *acc = d.acc + i * stride;
+      const __m256 f_lo = low_ps(f), f_hi = high_ps(f);
+      if constexpr (wide) {
+        const __m512d fd_lo = widen_pd(f_lo), fd_hi = widen_pd(f_hi);
+        __m512d a_k = _mm512_mask_i64gather_pd(fd_lo, in_lo, idx_lo, acc, 8);
+        _mm512_mask_i64scatter_pd(acc, in_lo, idx_lo,
+                                  _mm512_sub_pd(a_k, fd_lo), 8);
+        a_k = _mm512_mask_i64gather_pd(fd_hi, in_hi, idx_hi, acc, 8);
+        _mm512_mask_i64scatter_pd(acc, in_hi, idx_hi,
+                                  _mm512_sub_pd(a_k, fd_hi), 8);
+      } else {
+        __m256 a_k = _mm512_mask_i64gather_ps(f_lo, in_lo, idx_lo, acc, 4);
+        _mm512_mask_i64scatter_ps(acc, in_lo, idx_lo,
+                                  _mm256_sub_ps(a_k, f_lo), 4);
+        a_k = _mm512_mask_i64gather_ps(f_hi, in_hi, idx_hi, acc, 4);
+        _mm512_mask_i64scatter_ps(acc, in_hi, idx_hi,
+                                  _mm256_sub_ps(a_k, f_hi), 4);
+      }
+    }
+  }
 
-  // Calculate distance and separation
+  // Horizontal sums, in double
+  alignas(64) float lane[16];
+  double sum;
   for (i = 0; i < dim; i++) {
-    s[i] = part1.x[i] - part2.x[i];
-    d2 += std::pow(s[i], 2);
+    _mm512_store_ps(lane, f_j[i]);
+    for (l = 0, sum = 0; l < 16; l++)
+      sum += lane[l];
+    d.acc[i * stride + j] += sum;
   }
-  // Calculate multiplier
-  k = k_force(d2);
-  // Calculate force
-  for (i = 0; i < dim; i++)
-    F[i] = k * s[i];
-  return F;
+  for (i = 0; i < dim * dim; i++) {
+    _mm512_store_ps(lane, w[i]);
+    for (l = 0, sum = 0; l < 16; l++)
+      sum += lane[l];
+    d.virial[i] += sum;
+  }
+  _mm512_store_ps(lane, E_p);
+  for (l = 0, sum = 0; l < 16; l++)
+    sum += lane[l];
+  return sum;
+}
+
+#endif
+
+// Row of pairs: dispatch on the dimension, the arithmetic and the
+// instruction set
+template <size_t Dim, typename Real, typename Calc>
+double Lennard_Jones::force_row(const Basic_Pair_Data<Real, Calc> &d,
+                                size_t j, const size_t *k, size_t m) {
+  if constexpr (Dim == 0) {
+    switch (d.dim) {
+    case 2:
+      return force_row<2>(d, j, k, m);
+    case 3:
+      return force_row<3>(d, j, k, m);
+    default:
+      return ::pair_row<0, Lennard_Jones>(*this, d, j, k, m);
+    }
+  } else if constexpr (Dim > 3) {
+    return ::pair_row<Dim, Lennard_Jones>(*this, d, j, k, m);
+  } else {
+    const double eps4 = 4 * _epsilon, sigma2 = _sigma * _sigma;
+#ifdef MOLDYN_X86_SIMD
+    if constexpr (std::is_same<Calc, float>::value) {
+      switch (simd_level()) {
+      case simd_avx512:
+        return lj_row_avx512_ps<Dim>(eps4, sigma2, _shift, d, j, k, m);
+      case simd_avx2:
+        return lj_row_avx2_ps<Dim>(eps4, sigma2, _shift, d, j, k, m);
+      case simd_scalar:
+        break;
+      }
+    } else if constexpr (std::is_same<Real, double>::value) {
+      switch (simd_level()) {
+      case simd_avx512:
+        return lj_row_avx512<Dim>(eps4, sigma2, _shift, d, j, k, m);
+      case simd_avx2:
+        return lj_row_avx2<Dim>(eps4, sigma2, _shift, d, j, k, m);
+      case simd_scalar:
+        break;
+      }
+    }
+#endif
+    return lj_row_scalar<Dim>(eps4, sigma2, _shift, d, j, k, m);
+  }
+}
+
+// Row of pairs for Lennard-Jones models
+template <size_t Dim, typename Real, typename Calc>
+double pair_row(Lennard_Jones &model, const Basic_Pair_Data<Real, Calc> &d,
+                size_t j, const size_t *k, size_t m) {
+  return model.force_row<Dim>(d, j, k, m);
 }
 
 // Output
@@ -287,15 +2145,15 @@ void Lennard_Jones::plot_potential(size_t n_points, double point1,
   double d, step = (point2 - point1) / n_points;
 
   // Setup GNUPLOT
-  std::cout << "set key off" << std::endl;
-  std::cout << "set xrange [" << point1 << ':' << point2 << ']' << std::endl;
+  std::cout << "set key off" << '\n';
+  std::cout << "set xrange [" << point1 << ':' << point2 << ']' << '\n';
   // Call interactive terminal
-  std::cout << "plot \"-\" w l" << std::endl;
+  std::cout << "plot \"-\" w l" << '\n';
 
   d = point1 - step;
   for (i = 0; i < n_points; i++) {
     d += step;
-    std::cout << d << "\t\t" << potential(d * d) << std::endl;
+    std::cout << d << "\t\t" << potential(d * d) << '\n';
   }
 
   std::cout << 'e' << std::endl;
@@ -308,15 +2166,15 @@ void Lennard_Jones::plot_force(size_t n_points, double point1, double point2) {
   double d, step = (point2 - point1) / n_points;
 
   // Setup GNUPLOT
-  std::cout << "set key off" << std::endl;
-  std::cout << "set xrange [" << point1 << ':' << point2 << ']' << std::endl;
+  std::cout << "set key off" << '\n';
+  std::cout << "set xrange [" << point1 << ':' << point2 << ']' << '\n';
   // Call interactive terminal
-  std::cout << "plot \"-\" w l" << std::endl;
+  std::cout << "plot \"-\" w l" << '\n';
 
   d = point1 - step;
   for (i = 0; i < n_points; i++) {
     d += step;
-    std::cout << d << "\t\t" << k_force(d * d) << std::endl;
+    std::cout << d << "\t\t" << k_force(d * d) << '\n';
   }
 
   std::cout << 'e' << std::endl;
@@ -327,37 +2185,42 @@ void Lennard_Jones::plot_force(size_t n_points, double point1, double point2) {
 /*    Newtonian System of particles   */
 
 // Constructor
-template <typename Model>
-NewtonSys<Model>::NewtonSys(size_t dim, size_t n_particles, double mass,
-                            double T_init, double rho, Bound bound,
-                            Model model_)
-    : _dim(dim), _size(_dim), _time(0), _n_particles(n_particles), _mass(mass),
-      _particles(_n_particles, Particle(_dim, _mass)), _bound(bound),
+template <typename Model, size_t Dim, typename Precision>
+NewtonSys<Model, Dim, Precision>::NewtonSys(size_t dim_, size_t n_particles, double mass,
+                                 double T_init, double rho, Bound bound,
+                                 Model model_, Lattice lattice, double jitter,
+                                 double min_dist, unsigned seed)
+    : _dim(Dim ? Dim : dim_), _size(_dim), _time(0), _n_particles(n_particles),
+      _mass(mass), _particles(_dim, _n_particles),
+      _a_next(_dim * _particles.stride()), _bound(bound),
+      _n_threads(max_threads()), _E_p(0), _virial(_dim * _dim), _fresh(false),
+      _a_part(part_all), _switch_in2(0), _switch_out2(0),
+      _mersenne_engine(seed ? seed : random_seed()), _ids(n_particles),
+      _curve(curve_hilbert), _reorder_every(0), _reorder_count(0),
       model(model_) {
 
   // Dummy indices
-  size_t i, j, k;
+  size_t i, j;
   // Temporary value
   double temp;
-  // Temporary acceleration
-  std::vector<double> a_temp;
+
+  // The compile-time dimension wins
+  if (Dim && dim_ != Dim)
+    std::cerr << "Error: " << dim_ << "D system requested from NewtonSys<"
+              << model.name << ", " << Dim << ">, using " << Dim << "D"
+              << '\n';
 
   // Container size
-  for (i = 0; i < _dim; i++) {
-    _size[i] = std::pow(_n_particles * _mass / rho, 1.0 / _dim);
+  for (i = 0; i < dim(); i++) {
+    _size[i] = std::pow(_n_particles * _mass / rho, 1.0 / dim());
   }
 
-  // Random number generator
-  std::random_device rnd_dev;
-  std::mt19937 mersenne_engine(rnd_dev());
-
-  // Generate random positions
-  std::vector<std::uniform_real_distribution<double>> dist_position(_dim);
-  for (i = 0; i < _dim; i++)
-    dist_position[i] = std::uniform_real_distribution<double>(0, _size[i]);
+  // IDs in initial order
   for (j = 0; j < _n_particles; j++)
-    for (i = 0; i < _dim; i++)
-      _particles[j].x[i] = dist_position[i](mersenne_engine);
+    _ids[j] = j;
+
+  // Generate positions
+  _place(lattice, jitter, min_dist, _mersenne_engine);
 
   // Generate random velocities
   double norm, speed;
@@ -366,28 +2229,24 @@ NewtonSys<Model>::NewtonSys(size_t dim, size_t n_particles, double mass,
   std::normal_distribution<double> dist_speed(0, stddev);
   for (j = 0; j < _n_particles; j++) {
     norm = 0;
-    for (i = 0; i < _dim; i++) {
-      temp = dist_direction(mersenne_engine);
-      _particles[j].v[i] = temp;
-      norm += std::pow(temp, _dim);
+    for (i = 0; i < dim(); i++) {
+      temp = dist_direction(_mersenne_engine);
+      _particles.v(j, i) = temp;
+      norm += temp * temp;
     }
-    norm = std::pow(norm, 1.0 / _dim);
-    speed = dist_speed(mersenne_engine);
-    for (i = 0; i < _dim; i++)
-      _particles[j].v[i] *= speed / norm;
+    norm = std::sqrt(norm);
+    speed = dist_speed(_mersenne_engine);
+    for (i = 0; i < dim(); i++)
+      _particles.v(j, i) *= speed / norm;
   }
 
+  // Neighbour list skin: a tenth of the interaction range
+  if (std::isfinite(model.cutoff()))
+    set_skin(0.1 * model.cutoff());
+
   // Calculate accelerations
-  for (j = 0; j < _n_particles; j++) {
-    for (k = j + 1; k < _n_particles; k++) {
-      a_temp = model.force(_particles[j], _particles[k]);
-      for (i = 0; i < _dim; i++) {
-        a_temp[i] /= _mass;
-        _particles[j].a[i] += a_temp[i];
-        _particles[k].a[i] -= a_temp[i];
-      }
-    }
-  }
+  _accelerations(_a_next.data());
+  _particles.swap_a(_a_next);
 
   // Calculate energies
   _kinetic_0 = kinetic();
@@ -396,11 +2255,9 @@ NewtonSys<Model>::NewtonSys(size_t dim, size_t n_particles, double mass,
 
 // Getters
 
-// Number of dimensions
-template <typename Model> size_t NewtonSys<Model>::dim(void) { return _dim; }
-
 // Container size
-template <typename Model> double NewtonSys<Model>::size(size_t dim) {
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::size(size_t dim) {
   try {
     if (dim > _dim - 1)
       throw 0;
@@ -412,169 +2269,764 @@ template <typename Model> double NewtonSys<Model>::size(size_t dim) {
   }
 }
 
+// Time
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::time(void) {
+  return _time;
+}
+
 // Number of particles
-template <typename Model> size_t NewtonSys<Model>::n_particles(void) {
+template <typename Model, size_t Dim, typename Precision>
+size_t NewtonSys<Model, Dim, Precision>::n_particles(void) {
   return _n_particles;
 }
 
 // Particles mass
-template <typename Model> double NewtonSys<Model>::mass(void) { return _mass; }
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::mass(void) { return _mass; }
+
+// Neighbour list skin
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::skin(void) {
+  return _neighbors.skin();
+}
+
+// Number of neighbour list rebuilds
+template <typename Model, size_t Dim, typename Precision>
+size_t NewtonSys<Model, Dim, Precision>::n_rebuilds(void) {
+  return _neighbors.rebuilds();
+}
+
+// Number of listed pairs
+template <typename Model, size_t Dim, typename Precision>
+size_t NewtonSys<Model, Dim, Precision>::n_pairs(void) {
+  return _neighbors.n_pairs();
+}
+
+// Number of threads for force evaluation
+template <typename Model, size_t Dim, typename Precision>
+int NewtonSys<Model, Dim, Precision>::n_threads(void) {
+  return _n_threads;
+}
+
+// Particle arrays
+template <typename Model, size_t Dim, typename Precision>
+const Basic_Particle_Array<typename Precision::real> &
+NewtonSys<Model, Dim, Precision>::particles(void) {
+  return _particles;
+}
+
+// Setters
+
+// Neighbour list skin
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::set_skin(double skin) {
+  _neighbors.set_skin(skin);
+  _short_neighbors.set_skin(skin);
+}
+
+// Number of threads for force evaluation
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::set_threads(int n_threads) {
+  _n_threads = std::max(1, n_threads);
+}
+
+// Fast/slow split for multiple time steps
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::set_respa_switch(double r, double width) {
+  if (r <= 0 || r >= model.cutoff()) {
+    _switch_in2 = _switch_out2 = 0;
+  } else {
+    const double r_in = std::max(0.0, r - std::max(0.0, width));
+    _switch_in2 = r_in * r_in;
+    _switch_out2 = r * r;
+    // No skin without a cutoff: give the short list one
+    if (_short_neighbors.skin() == 0)
+      _short_neighbors.set_skin(0.1 * r);
+  }
+  // Split forces have to be evaluated again
+  if (_a_part == part_fast)
+    _a_part = part_slow;
+}
+
+// Reordering along a space-filling curve
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::set_reorder(size_t every, Curve curve) {
+  _reorder_every = every;
+  _curve = curve;
+  _reorder_count = 0;
+}
 
 // Kinetic energy
-template <typename Model> double NewtonSys<Model>::kinetic(void) {
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::kinetic(void) {
   size_t i, j;
   double E_k = 0;
-  // Sum on particles
-  for (j = 0; j < _n_particles; j++)
-    for (i = 0; i < _dim; i++)
-      E_k += std::pow(_particles[j].v[i], 2);
+  // Sum on particles, one component row at a time
+  for (i = 0; i < dim(); i++) {
+    const real *v = _particles.v(i);
+    for (j = 0; j < _n_particles; j++)
+      E_k += v[j] * v[j];
+  }
   return 0.5 * _mass * E_k;
 }
+
 // Potential energy
-template <typename Model> double NewtonSys<Model>::potential(void) {
-  size_t i, j, k;
-  double E_p = 0;
-  // Sum on pair of particles
-  for (j = 0; j < _n_particles; j++)
-    for (k = j + 1; k < _n_particles; k++)
-      E_p += 2 * model.potential(_particles[j], _particles[k]);
-  return E_p;
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::potential(void) {
+  _refresh();
+  return _E_p;
 }
 
-// Update
+// Virial tensor component (sum on pairs of s_a F_b)
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::virial(size_t a, size_t b) {
+  _refresh();
+  return _virial[a * dim() + b];
+}
 
-// Velocity-Verlet
-template <typename Model> void NewtonSys<Model>::vverlet(double dt) {
+// Pressure: (2 kinetic + virial trace) / (dim volume)
+template <typename Model, size_t Dim, typename Precision>
+double NewtonSys<Model, Dim, Precision>::pressure(void) {
+  size_t i;
+  double vol = 1, trace = 0;
+  _refresh();
+  for (i = 0; i < dim(); i++) {
+    vol *= _size[i];
+    trace += _virial[i * dim() + i];
+  }
+  return (2 * kinetic() + trace) / (dim() * vol);
+}
+
+// Separation vector between particles j and k and its length squared
+// Periodic boundaries use the minimum image
+template <typename Model, size_t Dim, typename Precision>
+template <typename V>
+double NewtonSys<Model, Dim, Precision>::_separation(size_t j, size_t k, V &s) {
+  double d2 = 0;
+  for (size_t i = 0; i < dim(); i++) {
+    const real *x = _particles.x(i);
+    s[i] = x[j] - x[k];
+    if (_bound == periodic) {
+      if (s[i] > 0.5 * _size[i])
+        s[i] -= _size[i];
+      else if (s[i] < -0.5 * _size[i])
+        s[i] += _size[i];
+    }
+    d2 += s[i] * s[i];
+  }
+  return d2;
+}
+
+// Bring the neighbour list up to date with the positions
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_update_neighbors(void) {
+  if (_neighbors.update(_particles, _size, model.cutoff(), _bound))
+    _counters.rebuilds++;
+}
+
+// Bring the list of the fast part up to date with the positions
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_update_short_neighbors(void) {
+  if (_short_neighbors.update(_particles, _size, std::sqrt(_switch_out2),
+                              _bound))
+    _counters.rebuilds++;
+}
+
+// Placement
+
+// Place particles
+template <typename Model, size_t Dim, typename Precision>
+template <typename Engine>
+void NewtonSys<Model, Dim, Precision>::_place(Lattice lattice, double jitter,
+                                   double min_dist, Engine &engine) {
 
   // Dummy indices
-  size_t i, j, k;
-  // Temporary variables
-  std::vector<double> a_temp(_dim), s_temp(_dim);
-  // Next acceleration
-  std::vector<std::vector<double>> a_next(_n_particles,
-                                          std::vector<double>(_dim));
+  size_t i, j;
 
-  // Update time
-  _time += dt;
+  if (lattice == lattice_random) {
+    _place_random(min_dist, engine);
+    return;
+  }
+  const Lattice_Sites sites(lattice, _size, _n_particles);
+  Dim_Vector<Dim> x(dim());
+
+  // n sites evenly spread over the container, with jitter in units of the
+  // mean spacing
+  double volume = 1;
+  for (i = 0; i < dim(); i++)
+    volume *= _size[i];
+  const double spacing = std::pow(volume / _n_particles, 1.0 / dim());
+  std::uniform_real_distribution<double> dist_jitter(-jitter * spacing,
+                                                     jitter * spacing);
+  for (j = 0; j < _n_particles; j++) {
+    sites.site(j, &x[0]);
+    for (i = 0; i < dim(); i++) {
+      if (jitter > 0)
+        x[i] += dist_jitter(engine);
+      if (_bound == periodic)
+        x[i] -= std::floor(x[i] / _size[i]) * _size[i];
+      else if (_bound == walls)
+        x[i] = std::min(std::max(x[i], 0.0), _size[i]);
+      _particles.x(j, i) = x[i];
+    }
+  }
+}
 
-  // Update positions
-  for (j = 0; j < _n_particles; j++)
-    for (i = 0; i < _dim; i++)
-      _particles[j].x[i] +=
-          _particles[j].v[i] * dt + 0.5 * _particles[j].a[i] * dt * dt;
+// Random placement no closer than a minimum distance
+template <typename Model, size_t Dim, typename Precision>
+template <typename Engine>
+void NewtonSys<Model, Dim, Precision>::_place_random(double min_dist, Engine &engine) {
 
-  // Check boundaries
-  switch (_bound) {
-  case walls:
-    for (j = 0; j < _n_particles; j++) {
-      for (i = 0; i < _dim; i++) {
-        if (_particles[j].x[i] < 0) {
-          _particles[j].x[i] = -_particles[j].x[i];
-          _particles[j].v[i] = -_particles[j].v[i];
-        } else if (_particles[j].x[i] > _size[i]) {
-          _particles[j].x[i] = 2 * _size[i] - _particles[j].x[i];
-          _particles[j].v[i] = -_particles[j].v[i];
+  // Dummy indices
+  size_t i, j, o;
+
+  std::vector<std::uniform_real_distribution<double>> dist_position(dim());
+  for (i = 0; i < dim(); i++)
+    dist_position[i] = std::uniform_real_distribution<double>(0, _size[i]);
+  if (min_dist <= 0) {
+    for (j = 0; j < _n_particles; j++)
+      for (i = 0; i < dim(); i++)
+        _particles.x(j, i) = dist_position[i](engine);
+    return;
+  }
+
+  // Grid of cells at least min_dist wide: a trial position is only checked
+  // against the particles in its cell and the neighbouring ones (all cells
+  // when there are fewer than 3 along a side)
+  std::vector<size_t> n_cells(dim());
+  size_t n_total = 1, n_offsets = 1;
+  bool few = false;
+  for (i = 0; i < dim(); i++) {
+    n_cells[i] = std::max(size_t(1), size_t(_size[i] / min_dist));
+    few = few || n_cells[i] < 3;
+    n_total *= n_cells[i];
+    n_offsets *= 3;
+  }
+  if (few) {
+    std::fill(n_cells.begin(), n_cells.end(), 1);
+    n_total = n_offsets = 1;
+  }
+  std::vector<std::vector<size_t>> cells(n_total);
+  const double min2 = min_dist * min_dist;
+  const size_t max_trials = 1000 * _n_particles + 1000;
+  size_t trials = 0;
+  Dim_Vector<Dim> x(dim()), s(dim());
+  std::vector<long> c(dim());
+
+  for (j = 0; j < _n_particles; j++) {
+    bool free = false;
+    while (!free) {
+      for (i = 0; i < dim(); i++) {
+        x[i] = dist_position[i](engine);
+        c[i] = std::min(long(x[i] / _size[i] * n_cells[i]),
+                        long(n_cells[i]) - 1);
+      }
+      // Give up the minimum distance once trials run out
+      free = ++trials > max_trials;
+      if (trials == max_trials + 1)
+        std::cerr << "Error: no room for " << _n_particles
+                  << " particles at distance " << min_dist
+                  << ", placing the rest at random" << '\n';
+      if (free)
+        break;
+      free = true;
+      for (o = 0; o < n_offsets && free; o++) {
+        // Neighbouring cell: offsets -1, 0, 1 along each side
+        size_t cell = 0, digits = o;
+        bool inside = true;
+        for (i = 0; i < dim(); i++) {
+          long ci = long(c[i]) + long(digits % 3) - (few ? 0 : 1);
+          digits /= 3;
+          if (ci < 0 || ci >= long(n_cells[i])) {
+            if (_bound != periodic)
+              inside = false;
+            ci = (ci + long(n_cells[i])) % long(n_cells[i]);
+          }
+          cell = cell * n_cells[i] + ci;
+        }
+        if (!inside)
+          continue;
+        for (size_t k : cells[cell]) {
+          double d2 = 0;
+          for (i = 0; i < dim(); i++) {
+            s[i] = x[i] - _particles.x(k, i);
+            if (_bound == periodic)
+              s[i] -= _size[i] * std::round(s[i] / _size[i]);
+            d2 += s[i] * s[i];
+          }
+          if (d2 < min2) {
+            free = false;
+            break;
+          }
         }
       }
     }
-    break;
-  case periodic:
-    for (j = 0; j < _n_particles; j++) {
-      for (i = 0; i < _dim; i++) {
-        if (_particles[j].x[i] < 0)
-          _particles[j].x[i] = _size[i] - _particles[j].x[i];
-        else if (_particles[j].x[i] > _size[i])
-          _particles[j].x[i] = -(_particles[j].x[i] - _size[i]);
-      }
+    size_t cell = 0;
+    for (i = 0; i < dim(); i++) {
+      _particles.x(j, i) = x[i];
+      cell = cell * n_cells[i] + c[i];
     }
-    break;
+    cells[cell].push_back(j);
   }
+}
 
-  // Calculate new acceleration and update velocities
-  switch (_bound) {
-  case walls:
-    for (j = 0; j < _n_particles; j++) {
-      for (k = j + 1; k < _n_particles; k++) {
-        a_temp = model.force(_particles[j], _particles[k]);
-        for (i = 0; i < _dim; i++) {
-          a_temp[i] /= _mass;
-          a_next[j][i] += a_temp[i];
-          a_next[k][i] -= a_temp[i];
-        }
-      }
-      for (i = 0; i < _dim; i++) {
-        _particles[j].v[i] += 0.5 * (_particles[j].a[i] + a_next[j][i]) * dt;
-        _particles[j].a[i] = a_next[j][i];
-      }
+// Place the particles again and recompute forces
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::place(Lattice lattice, double jitter,
+                                  double min_dist) {
+  _place(lattice, jitter, min_dist, _mersenne_engine);
+  _accelerations(_a_next.data());
+  _particles.swap_a(_a_next);
+  _a_part = part_all;
+  _kinetic_0 = kinetic();
+  _potential_0 = potential();
+}
+
+// Reorder the particle arrays along the curve
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::reorder(void) {
+
+  // Dummy indices
+  size_t i, j;
+
+  // Grid of 2^bits cells per side over the container (particles outside,
+  // without boundaries, go to the nearest cell)
+  const unsigned bits = unsigned(std::min<size_t>(31, 63 / dim()));
+  const double n_cells = double(uint64_t(1) << bits);
+  std::vector<uint64_t> cell(dim());
+
+  _keys.resize(_n_particles);
+  _order.resize(_n_particles);
+  for (j = 0; j < _n_particles; j++) {
+    for (i = 0; i < dim(); i++) {
+      const double c = std::floor(_particles.x(j, i) / _size[i] * n_cells);
+      cell[i] = uint64_t(c < 0 ? 0 : (c < n_cells ? c : n_cells - 1));
     }
-    break;
-  case periodic:
-    for (j = 0; j < _n_particles; j++) {
-      for (k = j + 1; k < _n_particles; k++) {
-        for (i = 0; i < _dim; i++) {
-          s_temp[i] = _particles[j].x[i] - _particles[k].x[i];
-          s_temp[i] = fmod(s_temp[i], _size[i] / 2);
-        }
-        a_temp = model.force(s_temp);
-        for (i = 0; i < _dim; i++) {
-          a_temp[i] /= _mass;
-          a_next[j][i] += a_temp[i];
-          a_next[k][i] -= a_temp[i];
+    _keys[j] = curve_key(_curve, dim(), cell.data(), bits);
+    _order[j] = j;
+  }
+  // Ties keep their order, so reordering twice changes nothing
+  std::sort(_order.begin(), _order.end(), [this](size_t a, size_t b) {
+    return _keys[a] < _keys[b] || (_keys[a] == _keys[b] && a < b);
+  });
+
+  // Everything kept per slot follows: particles, slow accelerations of
+  // RESPA, model data, IDs (_a_next only holds scratch between steps)
+  _particles.permute(_order.data(), _a_next);
+  if (_a_part == part_fast)
+    permute_rows(_a_slow, dim(), _particles.stride(), _order.data(),
+                 _n_particles, _a_next);
+  reorder_model(model, _order.data(), _n_particles);
+  for (j = 0; j < _n_particles; j++)
+    _order[j] = _ids[_order[j]];
+  _ids.swap(_order);
+
+  // Pairs are listed by slot
+  _neighbors.invalidate();
+  _short_neighbors.invalidate();
+  _reorder_count = 0;
+}
+
+// Update
+
+// Update positions
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_drift(double dt) {
+  size_t i, j;
+  for (i = 0; i < dim(); i++) {
+    real *x = _particles.x(i);
+    const real *v = _particles.v(i), *a = _particles.a(i);
+    for (j = 0; j < _n_particles; j++)
+      x[j] += v[j] * dt + 0.5 * a[j] * dt * dt;
+  }
+  _fresh = false;
+}
+
+// Apply boundary conditions
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_boundary(void) {
+  size_t i, j;
+  for (i = 0; i < dim(); i++) {
+    real *x = _particles.x(i), *v = _particles.v(i);
+    const double L = _size[i];
+    switch (_bound) {
+    case walls:
+      for (j = 0; j < _n_particles; j++) {
+        if (x[j] < 0) {
+          x[j] = -x[j];
+          v[j] = -v[j];
+        } else if (x[j] > L) {
+          x[j] = 2 * L - x[j];
+          v[j] = -v[j];
         }
       }
-      for (i = 0; i < _dim; i++) {
-        _particles[j].v[i] += 0.5 * (_particles[j].a[i] + a_next[j][i]) * dt;
-        _particles[j].a[i] = a_next[j][i];
+      break;
+    case periodic:
+      for (j = 0; j < _n_particles; j++) {
+        if (x[j] < 0)
+          x[j] += L;
+        else if (x[j] >= L)
+          x[j] -= L;
       }
+      break;
+    case unbounded:
+      break;
     }
-    break;
   }
+}
 
-  // Calculate new acceleration and update velocities
-  for (j = 0; j < _n_particles; j++) {
-    for (k = j + 1; k < _n_particles; k++) {
-      a_temp = model.force(_particles[j], _particles[k]);
-      for (i = 0; i < _dim; i++) {
-        a_temp[i] /= _mass;
-        a_next[j][i] += a_temp[i];
-        a_next[k][i] -= a_temp[i];
-      }
+// Calculate accelerations into a buffer laid out as the particle arrays
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_accelerations(real *acc,
+                                                      Force_Part part) {
+
+  // Distance between component rows
+  const size_t stride = _particles.stride();
+  // Buffer length
+  const long length = long(dim() * stride);
+  // Squared cutoff
+  const double cut2 = model.cutoff() * model.cutoff();
+  // Pair forces shared between fast and slow parts by the distance switch;
+  // without it they are all fast
+  const bool switched = part != part_all && _switch_out2 > 0;
+  const bool pairs = part != part_slow || switched;
+  // The fast part of a switch only reaches the switch radius: its pairs
+  // come from the short list, those of full weight through pair_row()
+  const bool inner = switched && part == part_fast;
+  Neighbor_List &list = inner ? _short_neighbors : _neighbors;
+
+  // Each thread accumulates both halves of its pairs into a private buffer
+  // (thread 0 straight into the result); buffers are then added in thread
+  // order, so results only depend on the number of threads
+  if (inner)
+    _update_short_neighbors();
+  else
+    _update_neighbors();
+  const long n_rows = long(list.n_rows());
+  if (pairs && model.cutoff() > 0)
+    _counters.pairs += list.listed() ? list.n_pairs()
+                                     : _n_particles * (_n_particles - 1) / 2;
+  const size_t n_virial = dim() * dim();
+  // Threads the team really has
+  int n_team = 1;
+#pragma omp parallel num_threads(_n_threads)
+  {
+    const int t = thread_id();
+#pragma omp single
+    {
+      n_team = team_size();
+      _thread_acc.resize(n_team - 1);
+      // One more slot for the long-range part
+      _thread_E_p.assign(n_team + 1, 0);
+      _thread_virial.assign((n_team + 1) * n_virial, 0);
+    }
+    real *buf = acc;
+    if (t > 0) {
+      _thread_acc[t - 1].resize(length);
+      buf = _thread_acc[t - 1].data();
+    }
+    for (long e = 0; e < length; e++)
+      buf[e] = 0;
+    double &E_t = _thread_E_p[t];
+    double *W_t = _thread_virial.data() + t * n_virial;
+    // Separation vector
+    Dim_Vector<Dim> s_temp(dim());
+    // Arrays for the row kernels
+    const Data data = {dim(),
+                       stride,
+                       _particles.x(0),
+                       buf,
+                       W_t,
+                       _bound == periodic ? _size.data() : nullptr,
+                       cut2,
+                       1 / _mass};
+    // Same, for the pairs inside the switch
+    Data data_in = data;
+    data_in.cut2 = _switch_in2;
+
+    // Sum on pair of neighbouring particles, rows dealt round-robin
+#pragma omp for schedule(static, 1)
+    for (long r = 0; r < (pairs ? n_rows : 0); r += ROW_CHUNK) {
+      const long end = std::min(r + ROW_CHUNK, n_rows);
+      if (inner)
+        list.for_each_row(
+            [&](size_t j, const size_t *k, size_t m) {
+              E_t += pair_row<Dim>(model, data_in, j, k, m);
+              E_t += switched_row<Dim>(model, data, j, k, m, part,
+                                       _switch_in2, _switch_out2, true);
+            },
+            r, end);
+      else if (list.listed() && switched)
+        list.for_each_row(
+            [&](size_t j, const size_t *k, size_t m) {
+              E_t += switched_row<Dim>(model, data, j, k, m, part,
+                                       _switch_in2, _switch_out2);
+            },
+            r, end);
+      else if (list.listed())
+        list.for_each_row(
+            [&](size_t j, const size_t *k, size_t m) {
+              E_t += pair_row<Dim>(model, data, j, k, m);
+            },
+            r, end);
+      else
+        list.for_each_pair(
+            [&](size_t j, size_t k) {
+              double d2 = _separation(j, k, s_temp);
+              if (d2 >= cut2)
+                return;
+              const double w =
+                  switched ? part_weight(part, d2, _switch_in2, _switch_out2)
+                           : 1;
+              double k_a;
+              E_t += w * model.pair(d2, k_a);
+              k_a *= w / _mass;
+              for (size_t i = 0; i < dim(); i++) {
+                buf[i * stride + j] += k_a * s_temp[i];
+                buf[i * stride + k] -= k_a * s_temp[i];
+                for (size_t b = 0; b < dim(); b++)
+                  W_t[i * dim() + b] += k_a * s_temp[i] * s_temp[b];
+              }
+            },
+            r, end);
+    }
+
+    // Reduction
+#pragma omp for schedule(static)
+    for (long e = 0; e < length; e++)
+      for (int u = 0; u < n_team - 1; u++)
+        acc[e] += _thread_acc[u][e];
+  }
+
+  // Long-range part, straight into the result
+  const Data whole = {dim(),
+                      stride,
+                      _particles.x(0),
+                      acc,
+                      _thread_virial.data() + n_team * n_virial,
+                      _bound == periodic ? _size.data() : nullptr,
+                      cut2,
+                      1 / _mass};
+  if (part != part_fast)
+    _thread_E_p[n_team] = long_range<Dim>(model, whole, _n_particles);
+
+  // Energy and virial, in thread order (virial back to force units)
+  _E_p = 0;
+  std::fill(_virial.begin(), _virial.end(), 0.0);
+  for (int t = 0; t <= n_team; t++) {
+    _E_p += _thread_E_p[t];
+    for (size_t e = 0; e < n_virial; e++)
+      _virial[e] += _thread_virial[t * n_virial + e] * _mass;
+  }
+  _fresh = part == part_all;
+}
+
+// Evaluate forces if positions changed since the last evaluation
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_refresh(void) {
+  if (!_fresh)
+    _accelerations(_a_next.data());
+}
+
+// Update velocities and accelerations
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::_kick(double dt) {
+  size_t i, j;
+  const size_t stride = _particles.stride();
+  for (i = 0; i < dim(); i++) {
+    real *v = _particles.v(i);
+    const real *a = _particles.a(i), *a_next = _a_next.data() + i * stride;
+    for (j = 0; j < _n_particles; j++)
+      v[j] += 0.5 * (a[j] + a_next[j]) * dt;
+  }
+  _particles.swap_a(_a_next);
+}
+
+// Velocity-Verlet
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::vverlet(double dt) {
+
+  const uint64_t allocs = PROFILING ? n_allocs.load() : 0;
+  _counters.steps++;
+
+  // Storage along the curve
+  if (_reorder_every && ++_reorder_count >= _reorder_every) {
+    Phase_Timer timer(_counters, phase_reorder);
+    reorder();
+  }
+
+  // Accelerations left by RESPA steps only hold part of the forces
+  if (_a_part != part_all) {
+    Phase_Timer timer(_counters, phase_force);
+    _accelerations(_a_next.data());
+    _particles.swap_a(_a_next);
+    _a_part = part_all;
+  }
+
+  // Update time
+  _time += dt;
+
+  // Update positions
+  {
+    Phase_Timer timer(_counters, phase_drift);
+    _drift(dt);
+  }
+
+  // Check boundaries
+  {
+    Phase_Timer timer(_counters, phase_boundary);
+    _boundary();
+  }
+
+  // Calculate new acceleration
+  {
+    Phase_Timer timer(_counters, phase_force);
+    _accelerations(_a_next.data());
+  }
+
+  // Update velocities
+  {
+    Phase_Timer timer(_counters, phase_kick);
+    _kick(dt);
+  }
+
+  if (PROFILING)
+    _counters.allocs += n_allocs.load() - allocs;
+}
+
+// RESPA
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::respa(double dt, size_t n_inner) {
+
+  // Dummy indices
+  size_t i, j, s;
+
+  const size_t stride = _particles.stride();
+  const double h = dt / (n_inner ? n_inner : 1);
+  const uint64_t allocs = PROFILING ? n_allocs.load() : 0;
+  _counters.steps++;
+
+  // Storage along the curve
+  if (_reorder_every && ++_reorder_count >= _reorder_every) {
+    Phase_Timer timer(_counters, phase_reorder);
+    reorder();
+  }
+
+  // Start from fast accelerations in the particle arrays and slow ones in
+  // their own buffer
+  if (_a_part != part_fast) {
+    Phase_Timer timer(_counters, phase_force);
+    _a_slow.resize(dim() * stride);
+    _accelerations(_a_next.data(), part_fast);
+    _particles.swap_a(_a_next);
+    _accelerations(_a_slow.data(), part_slow);
+    _a_part = part_fast;
+  }
+
+  // Slow half kick
+  {
+    Phase_Timer timer(_counters, phase_kick);
+    for (i = 0; i < dim(); i++) {
+      real *v = _particles.v(i);
+      const real *a = _a_slow.data() + i * stride;
+      for (j = 0; j < _n_particles; j++)
+        v[j] += 0.5 * a[j] * dt;
+    }
+  }
+
+  // Fast forces: velocity-Verlet with the inner step
+  for (s = 0; s < (n_inner ? n_inner : 1); s++) {
+    _time += h;
+    {
+      Phase_Timer timer(_counters, phase_drift);
+      _drift(h);
+    }
+    {
+      Phase_Timer timer(_counters, phase_boundary);
+      _boundary();
     }
-    for (i = 0; i < _dim; i++) {
-      _particles[j].v[i] += 0.5 * (_particles[j].a[i] + a_next[j][i]) * dt;
-      _particles[j].a[i] = a_next[j][i];
+    {
+      Phase_Timer timer(_counters, phase_force);
+      _accelerations(_a_next.data(), part_fast);
     }
+    Phase_Timer timer(_counters, phase_kick);
+    _kick(h);
   }
+
+  // Slow half kick with the new positions
+  {
+    Phase_Timer timer(_counters, phase_force);
+    _accelerations(_a_slow.data(), part_slow);
+  }
+  {
+    Phase_Timer timer(_counters, phase_kick);
+    for (i = 0; i < dim(); i++) {
+      real *v = _particles.v(i);
+      const real *a = _a_slow.data() + i * stride;
+      for (j = 0; j < _n_particles; j++)
+        v[j] += 0.5 * a[j] * dt;
+    }
+  }
+
+  if (PROFILING)
+    _counters.allocs += n_allocs.load() - allocs;
 }
 
 // Output
 
 // Output to gnuplot interactive terminal
-template <typename Model> void NewtonSys<Model>::out_gnuplot(void) {
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::out_gnuplot(void) {
+
+  // Includes waiting on the pipe
+  Phase_Timer timer(_counters, phase_output);
 
   // Setup GNUPLOT
-  std::cout << "set key off" << std::endl;
-  std::cout << "set xrange [" << 0 << ':' << _size[0] << ']' << std::endl;
-  std::cout << "set yrange [" << 0 << ':' << _size[1] << ']' << std::endl;
-  if (_dim == 3) {
-    std::cout << "set zrange [" << 0 << ':' << _size[2] << ']' << std::endl;
-    std::cout << "set view equal xyz" << std::endl;
+  std::cout << "set key off" << '\n';
+  std::cout << "set xrange [" << 0 << ':' << _size[0] << ']' << '\n';
+  std::cout << "set yrange [" << 0 << ':' << _size[1] << ']' << '\n';
+  if (dim() == 3) {
+    std::cout << "set zrange [" << 0 << ':' << _size[2] << ']' << '\n';
+    std::cout << "set view equal xyz" << '\n';
     // Call interactive terminal
-    std::cout << "splot \"-\" w p pt 7 ps 1" << std::endl;
+    std::cout << "splot \"-\" w p pt 7 ps 1" << '\n';
   } else
     // Call interactive terminal
-    std::cout << "plot \"-\" w p pt 7 ps 1" << std::endl;
+    std::cout << "plot \"-\" w p pt 7 ps 1" << '\n';
 
   for (size_t j = 0; j < _n_particles; j++) {
-    for (size_t i = 0; i < _dim; i++)
-      std::cout << _particles[j].x[i] << "\t\t";
-    std::cout << std::endl;
+    for (size_t i = 0; i < dim(); i++)
+      std::cout << _particles.x(j, i) << "\t\t";
+    std::cout << '\n';
   }
+  // End of data, flush once per frame
   std::cout << 'e' << std::endl;
 }
 
+// Publish positions to a live viewer, if a frame is due
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::publish(Snapshot_Publisher &pub) {
+  if (!pub.due())
+    return;
+  Phase_Timer timer(_counters, phase_output);
+  const size_t d = std::min(dim(), SNAP_MAX_DIM);
+  double *rows = pub.begin(d, _n_particles);
+  if (!rows)
+    return;
+  // In ID order
+  for (size_t i = 0; i < d; i++) {
+    const real *x = _particles.x(i);
+    double *row = rows + i * _n_particles;
+    for (size_t j = 0; j < _n_particles; j++)
+      row[_ids[j]] = x[j];
+  }
+  pub.commit(_time);
+}
+
 // Debug
-template <typename Model> void NewtonSys<Model>::debug(void) {
+template <typename Model, size_t Dim, typename Precision>
+void NewtonSys<Model, Dim, Precision>::debug(void) {
 
   // Dummy indices
   size_t i, j;
@@ -583,7 +3035,7 @@ template <typename Model> void NewtonSys<Model>::debug(void) {
 
   std::cerr << std::setprecision(6) << std::scientific;
 
-  std::cerr << _dim << "D: " << _n_particles << " particles"
+  std::cerr << dim() << "D: " << _n_particles << " particles"
             << "\n\n";
 
   std::cerr << "Model: " << model.name << "\n\n";
@@ -596,15 +3048,18 @@ template <typename Model> void NewtonSys<Model>::debug(void) {
   case periodic:
     std::cerr << "periodic";
     break;
+  case unbounded:
+    std::cerr << "unbounded";
+    break;
   }
   std::cerr << "\n\n";
 
   std::cerr << "Container size:" << '\n';
-  for (i = 0; i < _dim; i++)
+  for (i = 0; i < dim(); i++)
     std::cerr << _size[i] << '\n';
 
   double cont_vol = 1;
-  for (i = 0; i < _dim; i++)
+  for (i = 0; i < dim(); i++)
     cont_vol *= _size[i];
   std::cerr << "\nContainer volume: " << cont_vol << "\n\n";
 
@@ -614,23 +3069,155 @@ template <typename Model> void NewtonSys<Model>::debug(void) {
   std::cerr << "kinetic = " << kinetic() << '\n';
   std::cerr << "potential = " << potential() << "\n\n";
 
-  for (i = 0; i < _dim; i++)
+  for (i = 0; i < dim(); i++)
     std::cerr << "X_" << i << "\t\t";
-  for (i = 0; i < _dim; i++)
+  for (i = 0; i < dim(); i++)
     std::cerr << "V_" << i << "\t\t";
-  for (i = 0; i < _dim; i++)
+  for (i = 0; i < dim(); i++)
     std::cerr << "A_" << i << "\t\t";
   std::cerr << '\n';
 
-  for (auto particle : _particles) {
-    for (i = 0; i < _dim; i++)
-      std::cerr << particle.x[i] << '\t';
-    for (i = 0; i < _dim; i++)
-      std::cerr << particle.v[i] << '\t';
-    for (i = 0; i < _dim; i++)
-      std::cerr << particle.a[i] << '\t';
+  // In ID order
+  std::vector<size_t> slot(_n_particles);
+  for (j = 0; j < _n_particles; j++)
+    slot[_ids[j]] = j;
+  for (size_t id = 0; id < _n_particles; id++) {
+    j = slot[id];
+    for (i = 0; i < dim(); i++)
+      std::cerr << _particles.x(j, i) << '\t';
+    for (i = 0; i < dim(); i++)
+      std::cerr << _particles.v(j, i) << '\t';
+    for (i = 0; i < dim(); i++)
+      std::cerr << _particles.a(j, i) << '\t';
     std::cerr << '\n';
   }
 }
 
+// Checkpoints
+
+// Save the whole state to a file
+template <typename Model, size_t Dim, typename Precision>
+bool NewtonSys<Model, Dim, Precision>::checkpoint(const std::string &name) {
+  size_t i;
+  Ckpt_Writer w(ckpt_newton, dim(), _n_particles, sizeof(real),
+                model_id(model));
+  w.add(_time);
+  w.add(_size.data(), dim() * sizeof(double));
+  w.add(uint32_t(_bound));
+  w.add(_mass);
+  w.add(_neighbors.skin());
+  w.add(_switch_in2);
+  w.add(_switch_out2);
+  w.add(uint32_t(_a_part));
+  w.add(_kinetic_0);
+  w.add(_potential_0);
+  save_model(model, w);
+  std::ostringstream engine;
+  engine << _mersenne_engine;
+  w.add(engine.str());
+  for (i = 0; i < dim(); i++)
+    w.add(_particles.x(i), _n_particles * sizeof(real));
+  for (i = 0; i < dim(); i++)
+    w.add(_particles.v(i), _n_particles * sizeof(real));
+  for (i = 0; i < dim(); i++)
+    w.add(_particles.a(i), _n_particles * sizeof(real));
+  w.add(uint32_t(_curve));
+  w.add(uint64_t(_reorder_every));
+  w.add(uint64_t(_reorder_count));
+  w.add(_ids.data(), _n_particles * sizeof(size_t));
+  return w.write(name);
+}
+
+// Restore a saved state
+// Everything is read and checked first: a bad file leaves the system as it
+// was
+template <typename Model, size_t Dim, typename Precision>
+bool NewtonSys<Model, Dim, Precision>::restore(const std::string &name) {
+  size_t i, j;
+  const size_t bytes = _n_particles * sizeof(real);
+  Ckpt_Reader r(name, ckpt_newton, sizeof(real), model_id(model));
+  try {
+    if (!r.valid() || r.header().dim != dim() ||
+        r.header().n != _n_particles)
+      throw 0;
+    double time, mass, skin, switch_in2, switch_out2, kinetic_0, potential_0;
+    std::vector<double> size(dim());
+    uint32_t bound, part;
+    bool ok = r.get(time) && r.get(size.data(), dim() * sizeof(double)) &&
+              r.get(bound) && r.get(mass) && r.get(skin) &&
+              r.get(switch_in2) && r.get(switch_out2) && r.get(part) &&
+              r.get(kinetic_0) && r.get(potential_0);
+    if (!ok || bound > unbounded || (part != part_all && part != part_slow &&
+                                   part != part_fast))
+      throw 0;
+    // The model is replaced only if the rest of the file is good
+    Model loaded(model);
+    std::string engine_state;
+    std::mt19937 engine;
+    ok = load_model(loaded, r) && r.get(engine_state);
+    if (ok) {
+      std::istringstream in(engine_state);
+      ok = bool(in >> engine);
+    }
+    Basic_Particle_Array<real> particles(dim(), _n_particles);
+    for (i = 0; i < dim() && ok; i++)
+      ok = r.get(particles.x(i), bytes);
+    for (i = 0; i < dim() && ok; i++)
+      ok = r.get(particles.v(i), bytes);
+    for (i = 0; i < dim() && ok; i++)
+      ok = r.get(particles.a(i), bytes);
+    // Storage order, each ID once
+    uint32_t curve;
+    uint64_t every, count;
+    std::vector<size_t> ids(_n_particles), slot(_n_particles),
+        order(_n_particles, _n_particles);
+    ok = ok && r.get(curve) && r.get(every) && r.get(count) &&
+         r.get(ids.data(), _n_particles * sizeof(size_t)) &&
+         curve <= curve_hilbert;
+    // Slot each ID is in now, n once taken
+    for (j = 0; j < _n_particles; j++)
+      slot[_ids[j]] = j;
+    for (j = 0; j < _n_particles && ok; j++) {
+      ok = ids[j] < _n_particles && slot[ids[j]] < _n_particles;
+      if (ok)
+        std::swap(order[j], slot[ids[j]]);
+    }
+    if (!ok)
+      throw 0;
+    // All read: commit. The model data follows, from the order it is in now
+    model = std::move(loaded);
+    _order.swap(order);
+    reorder_model(model, _order.data(), _n_particles);
+    for (i = 0; i < dim(); i++) {
+      std::copy_n(particles.x(i), _n_particles, _particles.x(i));
+      std::copy_n(particles.v(i), _n_particles, _particles.v(i));
+      std::copy_n(particles.a(i), _n_particles, _particles.a(i));
+    }
+    _ids.swap(ids);
+    _size.assign(size.begin(), size.end());
+    _time = time;
+    _mass = mass;
+    _switch_in2 = switch_in2;
+    _switch_out2 = switch_out2;
+    _kinetic_0 = kinetic_0;
+    _potential_0 = potential_0;
+    _mersenne_engine = engine;
+    _curve = Curve(curve);
+    _reorder_every = every;
+    _reorder_count = count;
+    _bound = Bound(bound);
+    set_skin(skin);
+    _neighbors.invalidate();
+    _short_neighbors.invalidate();
+    // Split accelerations are recomputed by the next RESPA step
+    _a_part = part == part_all ? part_all : part_slow;
+    _fresh = false;
+  } catch (...) {
+    std::cerr << "Error: cannot restore " << name << " into a " << dim()
+              << "D system of " << _n_particles << " particles" << '\n';
+    return false;
+  }
+  return true;
+}
+
 // Newtonian System of particles
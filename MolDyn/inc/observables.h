@@ -0,0 +1,388 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+/*    On-the-fly observables   */
+
+// Observables accumulated while a run goes on, instead of being computed
+// from a stored trajectory: radial distribution function, mean squared
+// displacement, velocity autocorrelation and temperature. Each sample (a
+// frame, e.g. in a pipeline stage, or a system) updates them in place;
+// memory does not grow with the number of samples. The radial distribution
+// goes through every pair within its range, so samples are best taken every
+// few tens of steps (pipeline runs with n_every).
+// Time correlations go through multiple-tau correlators (J. Ramirez et al.,
+// J. Chem. Phys. 133, 154103 (2010)): distances up to p samples are exact,
+// longer ones use averages of m, m^2, ... consecutive samples, so p values
+// per level cover lags up to p m^(levels - 1) samples.
+
+/*    Multiple-tau correlator   */
+
+// Correlation of two samples a (earlier) and b of a vector of values:
+// sum of a b, or sum of (b - a)^2
+enum Correlation { corr_product, corr_square_distance };
+
+class Multi_Tau {
+
+  // Values per sample, points per level, number of levels, averaging
+  size_t _width, _points, _levels, _m;
+  Correlation _corr;
+  // Each level: last samples (points rows of width, circular), row of the
+  // newest one and number held, sum of samples towards the next level and
+  // their number
+  std::vector<std::vector<double>> _samples, _sum;
+  std::vector<size_t> _newest, _held, _n_sum;
+  // Each level and distance (in samples of the level): sum of the
+  // correlations and their number
+  std::vector<double> _total;
+  std::vector<uint64_t> _count;
+
+  // Add a sample to a level
+  void _add(size_t, const double *);
+
+public:
+  // Constructor
+  // IN: values per sample, correlation, points per level, number of
+  // levels, samples averaged from one level to the next
+  Multi_Tau(size_t, Correlation, size_t = 16, size_t = 8, size_t = 2);
+
+  // Add a sample (width values)
+  void add(const double *x) { _add(0, x); }
+
+  // Call f(lag, mean) for every lag with data, in increasing order: lag in
+  // samples, mean of the correlation (summed over the values)
+  template <typename F> void for_each_lag(F) const;
+};
+
+// Multiple-tau correlator
+
+/*    Observables   */
+
+class Observables {
+
+  // Number of dimensions, of particles and of tagged particles (first IDs,
+  // followed by the correlators)
+  size_t _dim, _n, _n_tagged;
+  // Boundary conditions
+  Bound _bound;
+  // Number of samples, time of the first one, time between samples
+  size_t _n_samples;
+  double _t_first, _interval;
+  // Temperature: last sample, running mean and sum of squared deviations
+  double _T, _T_mean, _T_m2;
+  // Radial distribution: range, histogram of pair distances, volume of
+  // the last sample, binning
+  double _r_max;
+  std::vector<uint64_t> _histogram;
+  double _volume;
+  Cell_List _cells;
+  std::vector<double> _size;
+  // Tagged particles: positions of the last sample, unwrapped positions
+  // and velocities (component rows of n_tagged)
+  std::vector<double> _x_last, _unwrapped, _velocity;
+  // Time correlations
+  Multi_Tau _msd, _vacf;
+  // Copy of a system for sample(System &)
+  std::unique_ptr<Pipe_Frame> _frame;
+
+  // Pair distances of a sample into the histogram
+  void _pairs(const Pipe_Frame &);
+
+public:
+  // Constructor
+  // IN: number of dimensions, number of particles, boundaries, range of
+  // the radial distribution (a few interaction ranges; 0 or, with periodic
+  // boundaries, beyond half the container: half the container), number of
+  // bins, tagged particles (0: all), points per level and levels of the
+  // correlators
+  // Correlators keep points x levels x dim values per tagged particle
+  Observables(size_t, size_t, Bound, double, size_t = 100, size_t = 0,
+              size_t = 16, size_t = 8);
+
+  // Add a sample: frames are in ID order, as particles are followed
+  void sample(const Pipe_Frame &);
+  // Same, from a system (through a copy in ID order)
+  template <typename System> void sample(System &);
+
+  // Getters
+  size_t n_samples(void) const { return _n_samples; }
+  // Temperature: last sample, mean and standard deviation over samples
+  double temperature(void) const { return _T; }
+  double temperature_mean(void) const { return _T_mean; }
+  double temperature_std(void) const;
+  // Radial distribution: bins, centre of bin b, g(r) in bin b
+  size_t n_bins(void) const { return _histogram.size(); }
+  double r(size_t) const;
+  double rdf(size_t) const;
+  // Mean squared displacement and velocity autocorrelation (per particle):
+  // f(time lag, value) for every lag with data
+  template <typename F> void for_each_msd(F) const;
+  template <typename F> void for_each_vacf(F) const;
+
+  // Write all of them to a file: comment lines, then blocks separated by
+  // two blank lines (gnuplot indices): "r g(r)", "t MSD", "t VACF"
+  bool write(const std::string &) const;
+};
+
+// Observables
+
+// On-the-fly observables
+
+/*    Multiple-tau correlator   */
+
+// Constructor
+Multi_Tau::Multi_Tau(size_t width, Correlation corr, size_t points,
+                     size_t levels, size_t m)
+    : _width(width), _points(points < 2 ? 2 : points),
+      _levels(levels ? levels : 1), _m(m < 2 ? 2 : m), _corr(corr),
+      _samples(_levels, std::vector<double>(_points * _width)),
+      _sum(_levels, std::vector<double>(_width)), _newest(_levels, 0),
+      _held(_levels, 0), _n_sum(_levels, 0), _total(_levels * _points, 0),
+      _count(_levels * _points, 0) {}
+
+// Add a sample to a level
+void Multi_Tau::_add(size_t level, const double *x) {
+
+  // Dummy indices
+  size_t j, e;
+
+  const size_t p = _points, w = _width;
+  double *rows = _samples[level].data();
+  _newest[level] = (_newest[level] + 1) % p;
+  double *b = rows + _newest[level] * w;
+  std::copy(x, x + w, b);
+  if (_held[level] < p)
+    _held[level]++;
+
+  // Against the samples j back (distances under p / m come from the level
+  // below)
+  for (j = level ? p / _m : 0; j < _held[level]; j++) {
+    const double *a = rows + (_newest[level] + p - j) % p * w;
+    double c = 0;
+    if (_corr == corr_product)
+      for (e = 0; e < w; e++)
+        c += a[e] * b[e];
+    else
+      for (e = 0; e < w; e++)
+        c += (b[e] - a[e]) * (b[e] - a[e]);
+    _total[level * p + j] += c;
+    _count[level * p + j]++;
+  }
+
+  // Average of m samples to the next level
+  if (level + 1 == _levels)
+    return;
+  double *s = _sum[level].data();
+  for (e = 0; e < w; e++)
+    s[e] += b[e];
+  if (++_n_sum[level] < _m)
+    return;
+  for (e = 0; e < w; e++)
+    s[e] /= _m;
+  _add(level + 1, s);
+  std::fill(s, s + w, 0.0);
+  _n_sum[level] = 0;
+}
+
+// Call f(lag, mean) for every lag with data
+template <typename F> void Multi_Tau::for_each_lag(F f) const {
+  size_t level, j, scale = 1;
+  for (level = 0; level < _levels; level++, scale *= _m)
+    for (j = level ? _points / _m : 0; j < _points; j++)
+      if (_count[level * _points + j])
+        f(j * scale, _total[level * _points + j] /
+                         double(_count[level * _points + j]));
+}
+
+// Multiple-tau correlator
+
+/*    Observables   */
+
+// Constructor
+Observables::Observables(size_t dim, size_t n, Bound bound, double r_max,
+                         size_t n_bins, size_t n_tagged, size_t points,
+                         size_t levels)
+    : _dim(dim), _n(n), _n_tagged(n_tagged && n_tagged < n ? n_tagged : n),
+      _bound(bound), _n_samples(0), _t_first(0), _interval(0), _T(0),
+      _T_mean(0), _T_m2(0), _r_max(r_max), _histogram(n_bins ? n_bins : 1),
+      _volume(0), _x_last(dim * _n_tagged), _unwrapped(dim * _n_tagged),
+      _velocity(dim * _n_tagged),
+      _msd(dim * _n_tagged, corr_square_distance, points, levels),
+      _vacf(dim * _n_tagged, corr_product, points, levels) {}
+
+// Add a sample
+void Observables::sample(const Pipe_Frame &f) {
+
+  // Dummy indices
+  size_t i, j;
+
+  const Particle_Array &p = f.particles();
+  const size_t m = _n_tagged;
+  _n_samples++;
+
+  // Times
+  if (_n_samples == 1)
+    _t_first = f.time();
+  else if (_n_samples == 2)
+    _interval = f.time() - _t_first;
+
+  // Temperature: kinetic energy is dim n k_B T / 2
+  _T = 2 * f.kinetic / (_dim * _n * K_B);
+  const double delta = _T - _T_mean;
+  _T_mean += delta / _n_samples;
+  _T_m2 += delta * (_T - _T_mean);
+
+  // Radial distribution
+  _pairs(f);
+
+  // Unwrapped positions: periodic images are followed by adding minimum
+  // image displacements (particles move less than half the container
+  // between samples)
+  for (i = 0; i < _dim; i++) {
+    const double *x = p.x(i), *v = p.v(i), L = f.size[i];
+    double *x_last = _x_last.data() + i * m, *u = _unwrapped.data() + i * m;
+    for (j = 0; j < m; j++) {
+      double s = x[j] - x_last[j];
+      if (_n_samples == 1)
+        s = x[j];
+      else if (_bound == periodic) {
+        if (s > 0.5 * L)
+          s -= L;
+        else if (s < -0.5 * L)
+          s += L;
+      }
+      u[j] += s;
+      x_last[j] = x[j];
+    }
+    std::copy(v, v + m, _velocity.data() + i * m);
+  }
+
+  // Time correlations
+  _msd.add(_unwrapped.data());
+  _vacf.add(_velocity.data());
+}
+
+// Add a sample from a system
+template <typename System> void Observables::sample(System &sys) {
+  if constexpr (std::is_same<System, Pipe_Frame>::value) {
+    // Non-const frames
+    sample(static_cast<const Pipe_Frame &>(sys));
+  } else {
+    if (!_frame)
+      _frame.reset(new Pipe_Frame(_dim, _n));
+    _frame->copy(sys, 0);
+    sample(static_cast<const Pipe_Frame &>(*_frame));
+  }
+}
+
+// Pair distances of a sample into the histogram
+void Observables::_pairs(const Pipe_Frame &f) {
+
+  // Dummy index
+  size_t i;
+
+  const Particle_Array &p = f.particles();
+  _volume = 1;
+  for (i = 0; i < _dim; i++)
+    _volume *= f.size[i];
+
+  // Binning set up on the first sample (or a new container); minimum
+  // images only go to half the container
+  if (_size != f.size) {
+    _size = f.size;
+    const double half = 0.5 * *std::min_element(_size.begin(), _size.end());
+    if (_r_max <= 0 || (_bound == periodic && _r_max > half))
+      _r_max = half;
+    _cells.setup(_size, _r_max, _n, _bound);
+  }
+  _cells.build(p);
+
+  const double r2_max = _r_max * _r_max, per_r = n_bins() / _r_max;
+  _cells.for_each_pair([&](size_t j, size_t k) {
+    double d2 = 0;
+    for (size_t a = 0; a < _dim; a++) {
+      double s = p.x(j, a) - p.x(k, a);
+      if (_bound == periodic) {
+        if (s > 0.5 * _size[a])
+          s -= _size[a];
+        else if (s < -0.5 * _size[a])
+          s += _size[a];
+      }
+      d2 += s * s;
+    }
+    if (d2 < r2_max)
+      _histogram[std::min(size_t(std::sqrt(d2) * per_r), n_bins() - 1)]++;
+  });
+}
+
+// Temperature standard deviation over samples
+double Observables::temperature_std(void) const {
+  return _n_samples > 1 ? std::sqrt(_T_m2 / (_n_samples - 1)) : 0;
+}
+
+// Centre of bin b
+double Observables::r(size_t b) const {
+  return (b + 0.5) * _r_max / n_bins();
+}
+
+// g(r) in bin b: pairs over those of an ideal gas of the same density
+double Observables::rdf(size_t b) const {
+  if (_n_samples == 0 || _n < 2)
+    return 0;
+  // Volume of the shell: unit ball pi^(d/2) / Gamma(d/2 + 1) times r^d
+  const double w = _r_max / n_bins(),
+               ball = std::pow(PI, 0.5 * _dim) / std::tgamma(0.5 * _dim + 1),
+               shell = ball * (std::pow((b + 1) * w, double(_dim)) -
+                               std::pow(b * w, double(_dim)));
+  const double ideal = _n_samples * 0.5 * _n * (_n - 1) * shell / _volume;
+  return _histogram[b] / ideal;
+}
+
+// Mean squared displacement per particle
+template <typename F> void Observables::for_each_msd(F f) const {
+  _msd.for_each_lag([&](size_t lag, double value) {
+    f(lag * _interval, value / _n_tagged);
+  });
+}
+
+// Velocity autocorrelation per particle
+template <typename F> void Observables::for_each_vacf(F f) const {
+  _vacf.for_each_lag([&](size_t lag, double value) {
+    f(lag * _interval, value / _n_tagged);
+  });
+}
+
+// Write all of them to a file
+bool Observables::write(const std::string &name) const {
+  std::ofstream out(name);
+  try {
+    if (!out)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot write " << name << '\n';
+    return false;
+  }
+  out << "# Samples: " << _n_samples << ", every " << _interval << '\n';
+  out << "# Temperature: " << temperature_mean() << " +- "
+      << temperature_std() << '\n';
+  out << "# r g(r)" << '\n';
+  for (size_t b = 0; b < n_bins(); b++)
+    out << r(b) << '\t' << rdf(b) << '\n';
+  out << "\n\n# t MSD" << '\n';
+  for_each_msd([&](double t, double value) {
+    out << t << '\t' << value << '\n';
+  });
+  out << "\n\n# t VACF" << '\n';
+  for_each_vacf([&](double t, double value) {
+    out << t << '\t' << value << '\n';
+  });
+  return bool(out);
+}
+
+// Observables
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "moldyn.h"
+
+/*    Staged pipeline   */
+
+// The integrator runs on the calling thread and hands copies of the state
+// (frames) to a chain of stages, each on its own thread: typically analysis,
+// then output. Frames come from a fixed pool and go back to it after the last
+// stage, so memory is bounded and a slow stage holds the integrator back
+// (backpressure) instead of piling up frames. With two frames or more, the
+// stages work on one frame while the integrator computes the next one.
+
+/*    Bounded queue   */
+
+template <typename T> class Bounded_Queue {
+
+  std::deque<T> _items;
+  size_t _capacity;
+  bool _closed;
+  std::mutex _mutex;
+  std::condition_variable _not_empty, _not_full;
+
+public:
+  // Constructor
+  // IN: capacity
+  Bounded_Queue(size_t capacity) : _capacity(capacity), _closed(false) {}
+
+  // Add an item, waiting while the queue is full
+  void push(T);
+  // Remove an item, waiting while the queue is empty
+  // OUT: false once the queue is closed and empty
+  bool pop(T &);
+  // No more items: wakes up waiting consumers
+  void close(void);
+};
+
+// Bounded queue
+
+/*    Pipeline frames   */
+
+// Copy of the state of a system at one time step, particles in ID order
+class Pipe_Frame {
+
+  size_t _step;
+  double _time;
+  // Positions and velocities (accelerations unused)
+  Particle_Array _particles;
+
+public:
+  // Energies and pressure at the time of the copy
+  double kinetic, potential, pressure;
+  // Container size
+  std::vector<double> size;
+
+  // Constructor
+  // IN: number of dimensions, number of particles
+  Pipe_Frame(size_t dim, size_t n)
+      : _step(0), _time(0), _particles(dim, n), kinetic(0), potential(0),
+        pressure(0), size(dim) {}
+
+  // Copy the state of a system
+  template <typename System> void copy(System &, size_t);
+
+  // Getters, as for a system (trajectory writers take frames too)
+  size_t step(void) const { return _step; }
+  double time(void) const { return _time; }
+  const Particle_Array &particles(void) const { return _particles; }
+
+  // Publish positions to a live viewer, if a frame is due
+  void publish(Snapshot_Publisher &) const;
+};
+
+// Pipeline frames
+
+/*    Pipeline    */
+
+template <typename System> class Pipeline {
+
+public:
+  // Stage: called on its own thread with every frame, in order
+  typedef std::function<void(const Pipe_Frame &)> Stage;
+
+private:
+  System &_sys;
+  // Steps done by all runs
+  size_t _step;
+  std::vector<Stage> _stages;
+  // Frame pool
+  std::vector<Pipe_Frame> _frames;
+
+public:
+  // Constructor
+  // IN: system, number of frames in flight (2: double buffering)
+  Pipeline(System &, size_t = 2);
+
+  // Add a stage after the existing ones
+  void add_stage(Stage);
+
+  // Advance n steps of dt, handing a frame to the stages every n_every
+  // steps (and after the last one); returns when all stages are done
+  void run(size_t, double, size_t = 1);
+};
+
+// Pipeline
+
+/*    Bounded queue   */
+
+// Add an item, waiting while the queue is full
+template <typename T> void Bounded_Queue<T>::push(T item) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _not_full.wait(lock, [this] { return _items.size() < _capacity; });
+  _items.push_back(std::move(item));
+  lock.unlock();
+  _not_empty.notify_one();
+}
+
+// Remove an item, waiting while the queue is empty
+template <typename T> bool Bounded_Queue<T>::pop(T &item) {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _not_empty.wait(lock, [this] { return !_items.empty() || _closed; });
+  if (_items.empty())
+    return false;
+  item = std::move(_items.front());
+  _items.pop_front();
+  lock.unlock();
+  _not_full.notify_one();
+  return true;
+}
+
+// No more items
+template <typename T> void Bounded_Queue<T>::close(void) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _closed = true;
+  _not_empty.notify_all();
+}
+
+// Bounded queue
+
+/*    Pipeline frames   */
+
+// Copy the state of a system
+template <typename System> void Pipe_Frame::copy(System &sys, size_t step) {
+  size_t i, j;
+  const auto &p = sys.particles();
+  const std::vector<size_t> &ids = sys.ids();
+  const size_t n = p.size();
+  _step = step;
+  _time = sys.time();
+  // In ID order, whatever the storage order
+  for (i = 0; i < p.dim(); i++) {
+    double *x = _particles.x(i), *v = _particles.v(i);
+    for (j = 0; j < n; j++) {
+      x[ids[j]] = p.x(i)[j];
+      v[ids[j]] = p.v(i)[j];
+    }
+    size[i] = sys.size(i);
+  }
+  kinetic = sys.kinetic();
+  potential = sys.potential();
+  pressure = sys.pressure();
+}
+
+// Publish positions to a live viewer, if a frame is due
+void Pipe_Frame::publish(Snapshot_Publisher &pub) const {
+  if (!pub.due())
+    return;
+  const size_t d = std::min(_particles.dim(), SNAP_MAX_DIM),
+               n = _particles.size();
+  double *rows = pub.begin(d, n);
+  if (!rows)
+    return;
+  for (size_t i = 0; i < d; i++)
+    std::copy(_particles.x(i), _particles.x(i) + n, rows + i * n);
+  pub.commit(_time);
+}
+
+// Pipeline frames
+
+/*    Pipeline    */
+
+// Constructor
+template <typename System>
+Pipeline<System>::Pipeline(System &sys, size_t n_frames)
+    : _sys(sys), _step(0) {
+  for (size_t f = 0; f < (n_frames ? n_frames : 1); f++)
+    _frames.emplace_back(sys.dim(), sys.n_particles());
+}
+
+// Add a stage after the existing ones
+template <typename System> void Pipeline<System>::add_stage(Stage stage) {
+  _stages.push_back(stage);
+}
+
+// Advance n steps
+template <typename System>
+void Pipeline<System>::run(size_t n_steps, double dt, size_t n_every) {
+
+  // Dummy indices
+  size_t s, step;
+
+  const size_t n_frames = _frames.size(), n_stages = _stages.size();
+  if (n_every == 0)
+    n_every = 1;
+
+  // Queue in front of each stage, the last one back to the pool
+  std::vector<std::unique_ptr<Bounded_Queue<Pipe_Frame *>>> queues;
+  for (s = 0; s <= n_stages; s++)
+    queues.emplace_back(new Bounded_Queue<Pipe_Frame *>(n_frames));
+  Bounded_Queue<Pipe_Frame *> &pool = *queues[n_stages];
+  for (Pipe_Frame &frame : _frames)
+    pool.push(&frame);
+
+  // Stage threads
+  std::vector<std::thread> threads;
+  for (s = 0; s < n_stages; s++)
+    threads.emplace_back([this, s, &queues] {
+      Pipe_Frame *frame;
+      while (queues[s]->pop(frame)) {
+        _stages[s](*frame);
+        queues[s + 1]->push(frame);
+      }
+      if (s + 1 < _stages.size())
+        queues[s + 1]->close();
+    });
+
+  // Integrator
+  for (step = 1; step <= n_steps; step++) {
+    _sys.vverlet(dt);
+    _step++;
+    if (step % n_every && step != n_steps)
+      continue;
+    // Waits here if every frame is still in the stages
+    Pipe_Frame *frame;
+    pool.pop(frame);
+    frame->copy(_sys, _step);
+    if (n_stages)
+      queues[0]->push(frame);
+    else
+      pool.push(frame);
+  }
+
+  // Drain
+  if (n_stages)
+    queues[0]->close();
+  for (std::thread &t : threads)
+    t.join();
+}
+
+// Pipeline
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*    Snapshot ring buffer    */
+
+// Snapshots of point sets published by a simulation into POSIX shared memory
+// and read by a viewer process.
+// One producer, which never waits: it overwrites the oldest slot. Each slot
+// is guarded by a sequence number (odd while written), so a reader that was
+// overtaken notices and tries again with the latest frame, a few times: a
+// frame that stays unreadable (producer stopped mid-write, corrupt slot) is
+// given up. Frames the reader never shows are counted as dropped.
+// Points are stored as component rows: row i holds coordinate i of every
+// point.
+
+// Plot style
+enum Snap_Style : uint32_t { snap_points, snap_lines };
+
+const uint64_t SNAP_MAGIC = 0x31504e5344594d4dULL;
+const size_t SNAP_MAX_DIM = 3;
+// Attempts to read the latest frame before giving it up
+const int SNAP_RETRIES = 8;
+
+// Shared memory header
+struct Snap_Header {
+  uint64_t magic;
+  uint64_t n_slots;
+  uint64_t slot_bytes;
+  uint64_t max_dim;
+  uint64_t max_points;
+  // View: plot style and axis ranges
+  uint32_t style;
+  uint32_t view_dim;
+  double lo[SNAP_MAX_DIM], hi[SNAP_MAX_DIM];
+  // Frames published
+  std::atomic<uint64_t> head;
+  // Frames shown by the viewer
+  std::atomic<uint64_t> shown;
+  // Producer finished
+  std::atomic<uint32_t> closed;
+};
+
+// Slot header, followed by the component rows at offset 64
+struct Snap_Slot {
+  // 2 (frame number + 1) when complete, odd while written
+  std::atomic<uint64_t> seq;
+  double time;
+  uint32_t dim;
+  uint32_t n_points;
+};
+
+const size_t SNAP_SLOT_DATA = 64;
+
+// Snapshot ring buffer
+
+/*    Snapshot publisher    */
+
+class Snapshot_Publisher {
+
+  std::string _name;
+  Snap_Header *_header;
+  char *_slots;
+  size_t _length;
+  // Minimum time between published frames
+  std::chrono::steady_clock::duration _period;
+  std::chrono::steady_clock::time_point _last;
+  // Slot being written
+  Snap_Slot *_slot;
+
+public:
+  // Constructor
+  // IN: shared memory name ("/name"), maximum number of dimensions and of
+  // points, frames per second (0: no limit), number of slots
+  // Creates (or replaces) the shared memory object
+  Snapshot_Publisher(const std::string &, size_t, size_t, double = 30,
+                     size_t = 4);
+  // Marks the buffer closed and removes the name
+  ~Snapshot_Publisher(void);
+
+  Snapshot_Publisher(const Snapshot_Publisher &) = delete;
+  Snapshot_Publisher &operator=(const Snapshot_Publisher &) = delete;
+
+  // Set the view: plot style, number of dimensions, axis ranges
+  void set_view(Snap_Style, size_t, const double *, const double *);
+
+  // Getters
+  bool valid(void) const { return _header != nullptr; }
+  // Frames published
+  uint64_t published(void) const;
+  // Frames published and not shown by the viewer
+  uint64_t dropped(void) const;
+
+  // A frame is due (rate limit): only then the caller prepares one
+  bool due(void);
+  // Start a frame of n points in dim dimensions
+  // OUT: component rows to fill (stride n)
+  double *begin(size_t, size_t);
+  // Publish the frame started with begin
+  void commit(double);
+};
+
+// Snapshot publisher
+
+/*    Snapshot reader   */
+
+class Snapshot_Reader {
+
+  Snap_Header *_header;
+  char *_slots;
+  size_t _length;
+  // Last frame returned
+  uint64_t _last;
+  uint64_t _dropped;
+
+public:
+  // Constructor
+  // IN: shared memory name
+  Snapshot_Reader(const std::string &);
+  ~Snapshot_Reader(void);
+
+  Snapshot_Reader(const Snapshot_Reader &) = delete;
+  Snapshot_Reader &operator=(const Snapshot_Reader &) = delete;
+
+  // Getters
+  bool valid(void) const { return _header != nullptr; }
+  bool closed(void) const;
+  const Snap_Header &header(void) const { return *_header; }
+  // Frames published and skipped by this reader
+  uint64_t dropped(void) const { return _dropped; }
+
+  // Copy the latest frame if newer than the last one returned
+  // OUT: time, number of dimensions and of points, component rows
+  // (room for max_dim * max_points values); false if no new frame could be
+  // read (poll again later)
+  bool latest(double &, size_t &, size_t &, double *);
+};
+
+// Snapshot reader
+
+/*    Snapshot publisher    */
+
+// Constructor
+Snapshot_Publisher::Snapshot_Publisher(const std::string &name,
+                                       size_t max_dim, size_t max_points,
+                                       double rate, size_t n_slots)
+    : _name(name), _header(nullptr), _slots(nullptr), _length(0),
+      _period(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(rate > 0 ? 1 / rate : 0))),
+      _last(std::chrono::steady_clock::now() - _period), _slot(nullptr) {
+
+  const size_t slot_bytes =
+      (SNAP_SLOT_DATA + max_dim * max_points * sizeof(double) + 63) / 64 * 64;
+  _length = sizeof(Snap_Header) + 64 + n_slots * slot_bytes;
+
+  int fd = -1;
+  void *map = MAP_FAILED;
+  try {
+    if (max_dim > SNAP_MAX_DIM || n_slots < 2)
+      throw 0;
+    shm_unlink(_name.c_str());
+    fd = shm_open(_name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, _length) != 0)
+      throw 0;
+    map = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot create shared memory " << _name << '\n';
+    if (fd >= 0) {
+      ::close(fd);
+      shm_unlink(_name.c_str());
+    }
+    return;
+  }
+  ::close(fd);
+
+  // Slots start on a cache line after the header
+  _header = new (map) Snap_Header();
+  _slots = static_cast<char *>(map) +
+           (sizeof(Snap_Header) + 63) / 64 * 64;
+  for (size_t s = 0; s < n_slots; s++)
+    new (_slots + s * slot_bytes) Snap_Slot();
+  _header->n_slots = n_slots;
+  _header->slot_bytes = slot_bytes;
+  _header->max_dim = max_dim;
+  _header->max_points = max_points;
+  _header->style = snap_points;
+  _header->view_dim = max_dim;
+  for (size_t i = 0; i < SNAP_MAX_DIM; i++) {
+    _header->lo[i] = 0;
+    _header->hi[i] = 1;
+  }
+  // Written last: readers check it
+  std::atomic_thread_fence(std::memory_order_release);
+  _header->magic = SNAP_MAGIC;
+}
+
+// Marks the buffer closed and removes the name
+Snapshot_Publisher::~Snapshot_Publisher(void) {
+  if (!_header)
+    return;
+  _header->closed.store(1, std::memory_order_release);
+  munmap(_header, _length);
+  shm_unlink(_name.c_str());
+}
+
+// Set the view
+void Snapshot_Publisher::set_view(Snap_Style style, size_t dim,
+                                  const double *lo, const double *hi) {
+  if (!_header)
+    return;
+  _header->style = style;
+  _header->view_dim = dim;
+  for (size_t i = 0; i < dim && i < SNAP_MAX_DIM; i++) {
+    _header->lo[i] = lo[i];
+    _header->hi[i] = hi[i];
+  }
+}
+
+// Frames published
+uint64_t Snapshot_Publisher::published(void) const {
+  return _header ? _header->head.load(std::memory_order_relaxed) : 0;
+}
+
+// Frames published and not shown by the viewer
+uint64_t Snapshot_Publisher::dropped(void) const {
+  if (!_header)
+    return 0;
+  uint64_t shown = _header->shown.load(std::memory_order_relaxed);
+  uint64_t head = _header->head.load(std::memory_order_relaxed);
+  return head > shown ? head - shown : 0;
+}
+
+// A frame is due
+bool Snapshot_Publisher::due(void) {
+  if (!_header)
+    return false;
+  auto now = std::chrono::steady_clock::now();
+  if (now - _last < _period)
+    return false;
+  _last = now;
+  return true;
+}
+
+// Start a frame
+double *Snapshot_Publisher::begin(size_t dim, size_t n) {
+  try {
+    if (!_header || dim > _header->max_dim || n > _header->max_points)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: snapshot too large" << '\n';
+    _slot = nullptr;
+    return nullptr;
+  }
+  const uint64_t frame = _header->head.load(std::memory_order_relaxed);
+  _slot = reinterpret_cast<Snap_Slot *>(
+      _slots + frame % _header->n_slots * _header->slot_bytes);
+  // Odd: being written
+  _slot->seq.store(2 * frame + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  _slot->dim = dim;
+  _slot->n_points = n;
+  return reinterpret_cast<double *>(reinterpret_cast<char *>(_slot) +
+                                    SNAP_SLOT_DATA);
+}
+
+// Publish the frame started with begin
+void Snapshot_Publisher::commit(double time) {
+  if (!_slot)
+    return;
+  const uint64_t frame = _header->head.load(std::memory_order_relaxed);
+  _slot->time = time;
+  _slot->seq.store(2 * (frame + 1), std::memory_order_release);
+  _header->head.store(frame + 1, std::memory_order_release);
+  _slot = nullptr;
+}
+
+// Snapshot publisher
+
+/*    Snapshot reader   */
+
+// Constructor
+Snapshot_Reader::Snapshot_Reader(const std::string &name)
+    : _header(nullptr), _slots(nullptr), _length(0), _last(0), _dropped(0) {
+
+  int fd = -1;
+  void *map = MAP_FAILED;
+  try {
+    fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        size_t(st.st_size) < sizeof(Snap_Header))
+      throw 0;
+    _length = st.st_size;
+    map = mmap(nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      throw 0;
+    if (static_cast<Snap_Header *>(map)->magic != SNAP_MAGIC)
+      throw 0;
+  } catch (...) {
+    if (map != MAP_FAILED)
+      munmap(map, _length);
+    if (fd >= 0)
+      ::close(fd);
+    return;
+  }
+  ::close(fd);
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  _header = static_cast<Snap_Header *>(map);
+  _slots = static_cast<char *>(map) + (sizeof(Snap_Header) + 63) / 64 * 64;
+}
+
+Snapshot_Reader::~Snapshot_Reader(void) {
+  if (_header)
+    munmap(_header, _length);
+}
+
+// Producer finished
+bool Snapshot_Reader::closed(void) const {
+  return !_header || _header->closed.load(std::memory_order_acquire);
+}
+
+// Copy the latest frame if newer than the last one returned
+bool Snapshot_Reader::latest(double &time, size_t &dim, size_t &n,
+                             double *rows) {
+  if (!_header)
+    return false;
+  uint64_t head = _last;
+  for (int attempt = 0; attempt < SNAP_RETRIES; attempt++) {
+    head = _header->head.load(std::memory_order_acquire);
+    if (head == _last)
+      return false;
+    const Snap_Slot *slot = reinterpret_cast<const Snap_Slot *>(
+        _slots + (head - 1) % _header->n_slots * _header->slot_bytes);
+    const uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq != 2 * head)
+      continue;
+    time = slot->time;
+    dim = slot->dim;
+    n = slot->n_points;
+    // Corrupt: give it up at once
+    if (dim > _header->max_dim || n > _header->max_points)
+      break;
+    std::memcpy(rows,
+                reinterpret_cast<const char *>(slot) + SNAP_SLOT_DATA,
+                dim * n * sizeof(double));
+    // Overwritten while copying: try again with the newer frame
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->seq.load(std::memory_order_relaxed) != seq)
+      continue;
+    _dropped += head - _last - 1;
+    _last = head;
+    _header->shown.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  // Unreadable: dropped, like a frame overtaken before it was shown
+  _dropped += head - _last;
+  _last = head;
+  return false;
+}
+
+// Snapshot reader
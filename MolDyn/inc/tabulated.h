@@ -0,0 +1,281 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+
+#include "moldyn.h"
+
+/*    Tabulated model   */
+
+// Pair model evaluated from tables on a uniform grid in r^2 between r_min
+// and the cutoff, built once: from any model, or from a file. Each interval
+// stores cubic polynomials (in the fraction t of the interval) for the
+// energy (Hermite, with the slope from the force) and for the force
+// multiplier k (natural cubic spline), or straight lines. Evaluating a pair
+// is an index computation and two polynomials, with no sqrt, pow or exp.
+// The energy can be shifted to vanish at the cutoff. Closer than r_min the
+// first interval is extrapolated.
+// Table files: lines "r U F" (F = -dU/dr), r increasing, '#' comments.
+
+// Model of tables read from a file (no analytic form behind them)
+struct Table_File {};
+
+template <typename Model = Table_File> class Tabulated {
+
+  // Cutoff radius, squared, grid start and inverse spacing in r^2
+  double _r_cut, _r2_cut, _r2_min, _inv_h;
+  // Number of intervals
+  size_t _n;
+  // Energy at the cutoff, subtracted when shifted
+  double _shift;
+  // Per interval: energy then k polynomial coefficients (constant first)
+  std::vector<double> _coef;
+
+  // Build the tables from energies and force multipliers at the grid points
+  void _build(const std::vector<double> &, const std::vector<double> &, bool);
+
+public:
+  // Name
+  static const std::string name;
+  // Constructor
+  // IN: model (finite cutoff), r_min, number of intervals, shift the energy
+  // to zero at the cutoff, cubic (else linear) interpolation
+  Tabulated(const Model &, double, size_t = 2000, bool = true, bool = true);
+  // Constructor from a table file
+  // IN: file name, number of intervals, shift, cubic interpolation
+  Tabulated(const std::string &, size_t = 2000, bool = true, bool = true);
+  // Interaction range
+  double cutoff(void) const { return _r_cut; }
+  // Energy shift applied
+  double shift(void) const { return _shift; }
+  // Potential energy
+  double potential(double) const;
+  double potential(const double *, size_t) const;
+  double potential(const Particle &, const Particle &) const;
+  // Force
+  double k_force(double) const;
+  void force(const double *, size_t, double *) const;
+  void force(const Particle &, const Particle &, double *) const;
+  // Force multiplier and potential energy
+  double pair(double, double &) const;
+};
+
+// Tabulated model
+
+/*    Tabulated model   */
+
+// Name
+template <typename Model>
+const std::string Tabulated<Model>::name = "Tabulated " + Model::name;
+template <> const std::string Tabulated<Table_File>::name = "Tabulated (file)";
+
+// Natural cubic spline second derivatives of y on points x (any spacing)
+inline std::vector<double> spline_second(const std::vector<double> &x,
+                                         const std::vector<double> &y) {
+  const size_t n = x.size();
+  std::vector<double> y2(n, 0), u(n, 0);
+  for (size_t i = 1; i + 1 < n; i++) {
+    const double sig = (x[i] - x[i - 1]) / (x[i + 1] - x[i - 1]);
+    const double p = sig * y2[i - 1] + 2;
+    y2[i] = (sig - 1) / p;
+    u[i] = (y[i + 1] - y[i]) / (x[i + 1] - x[i]) -
+           (y[i] - y[i - 1]) / (x[i] - x[i - 1]);
+    u[i] = (6 * u[i] / (x[i + 1] - x[i - 1]) - sig * u[i - 1]) / p;
+  }
+  y2[n - 1] = 0;
+  for (size_t i = n - 1; i-- > 0;)
+    y2[i] = y2[i] * y2[i + 1] + u[i];
+  return y2;
+}
+
+// Natural cubic spline value at xv
+inline double spline_value(const std::vector<double> &x,
+                           const std::vector<double> &y,
+                           const std::vector<double> &y2, double xv) {
+  size_t hi = std::upper_bound(x.begin(), x.end(), xv) - x.begin();
+  hi = std::min(std::max(hi, size_t(1)), x.size() - 1);
+  const size_t lo = hi - 1;
+  const double h = x[hi] - x[lo], a = (x[hi] - xv) / h, b = (xv - x[lo]) / h;
+  return a * y[lo] + b * y[hi] +
+         ((a * a * a - a) * y2[lo] + (b * b * b - b) * y2[hi]) * h * h / 6;
+}
+
+// Constructor from a model
+template <typename Model>
+Tabulated<Model>::Tabulated(const Model &model, double r_min, size_t n,
+                            bool shifted, bool cubic)
+    : _r_cut(model.cutoff()), _n(n ? n : 1), _shift(0) {
+  try {
+    if (!(_r_cut > r_min) || std::isinf(_r_cut) || r_min <= 0)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: tables need 0 < r_min < cutoff < INF" << '\n';
+    _r_cut = 0;
+    _n = 0;
+    return;
+  }
+  _r2_cut = _r_cut * _r_cut;
+  _r2_min = r_min * r_min;
+  _inv_h = _n / (_r2_cut - _r2_min);
+  std::vector<double> U(_n + 1), k(_n + 1);
+  for (size_t i = 0; i <= _n; i++) {
+    const double r2 = _r2_min + i / _inv_h;
+    U[i] = model.pair(r2, k[i]);
+  }
+  if (shifted)
+    _shift = U[_n];
+  _build(U, k, cubic);
+}
+
+// Constructor from a table file
+template <typename Model>
+Tabulated<Model>::Tabulated(const std::string &file_name, size_t n,
+                            bool shifted, bool cubic)
+    : _r_cut(0), _n(n ? n : 1), _shift(0) {
+  std::vector<double> r, U_r, F_r;
+  try {
+    std::ifstream file(file_name);
+    if (!file)
+      throw 0;
+    std::string line;
+    while (std::getline(file, line)) {
+      if (line.empty() || line[0] == '#')
+        continue;
+      std::istringstream fields(line);
+      double a, b, c;
+      if (!(fields >> a >> b >> c))
+        continue;
+      if (!r.empty() && a <= r.back())
+        throw 0;
+      r.push_back(a);
+      U_r.push_back(b);
+      F_r.push_back(c);
+    }
+    if (r.size() < 2 || r[0] <= 0)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot read table " << file_name << '\n';
+    _n = 0;
+    return;
+  }
+  _r_cut = r.back();
+  _r2_cut = _r_cut * _r_cut;
+  _r2_min = r[0] * r[0];
+  _inv_h = _n / (_r2_cut - _r2_min);
+
+  // Resample on the uniform r^2 grid
+  const std::vector<double> U2 = spline_second(r, U_r), F2 = spline_second(r, F_r);
+  std::vector<double> U(_n + 1), k(_n + 1);
+  for (size_t i = 0; i <= _n; i++) {
+    const double r_i = std::sqrt(_r2_min + i / _inv_h);
+    U[i] = spline_value(r, U_r, U2, r_i);
+    k[i] = spline_value(r, F_r, F2, r_i) / r_i;
+  }
+  if (shifted)
+    _shift = U[_n];
+  _build(U, k, cubic);
+}
+
+// Build the tables
+template <typename Model>
+void Tabulated<Model>::_build(const std::vector<double> &U,
+                              const std::vector<double> &k, bool cubic) {
+  size_t i;
+  const double h = 1 / _inv_h;
+  _coef.assign(8 * _n, 0);
+
+  // Natural spline of k on the uniform grid (second derivatives M)
+  std::vector<double> grid(_n + 1), M(_n + 1, 0);
+  for (i = 0; i <= _n; i++)
+    grid[i] = i * h;
+  if (cubic)
+    M = spline_second(grid, k);
+
+  for (i = 0; i < _n; i++) {
+    double *c = &_coef[8 * i];
+    const double U0 = U[i] - _shift, U1 = U[i + 1] - _shift;
+    c[0] = U0;
+    c[4] = k[i];
+    if (cubic) {
+      // Energy: Hermite with dU/d(r^2) = -k / 2, slopes per interval
+      const double s0 = -0.5 * k[i] * h, s1 = -0.5 * k[i + 1] * h;
+      c[1] = s0;
+      c[2] = 3 * (U1 - U0) - 2 * s0 - s1;
+      c[3] = 2 * (U0 - U1) + s0 + s1;
+      // Force multiplier: spline
+      c[5] = (k[i + 1] - k[i]) - h * h * (2 * M[i] + M[i + 1]) / 6;
+      c[6] = h * h * M[i] / 2;
+      c[7] = h * h * (M[i + 1] - M[i]) / 6;
+    } else {
+      c[1] = U1 - U0;
+      c[5] = k[i + 1] - k[i];
+    }
+  }
+}
+
+// Force multiplier and potential energy
+template <typename Model>
+double Tabulated<Model>::pair(double d2, double &k) const {
+  if (d2 >= _r2_cut || _n == 0) {
+    k = 0;
+    return 0;
+  }
+  const double u = (d2 - _r2_min) * _inv_h;
+  // u may round up to n just below the cutoff: t = 1 of the last interval
+  const long i = u < 0 ? 0 : std::min(long(u), long(_n) - 1);
+  const double t = u - i;
+  const double *c = &_coef[8 * i];
+  k = ((c[7] * t + c[6]) * t + c[5]) * t + c[4];
+  return ((c[3] * t + c[2]) * t + c[1]) * t + c[0];
+}
+
+// Potential energy
+template <typename Model>
+double Tabulated<Model>::potential(double d2) const {
+  double k;
+  return pair(d2, k);
+}
+template <typename Model>
+double Tabulated<Model>::potential(const double *s, size_t dim) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  return potential(d2);
+}
+template <typename Model>
+double Tabulated<Model>::potential(const Particle &part1,
+                                   const Particle &part2) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  return potential(d2);
+}
+
+// Force
+template <typename Model>
+double Tabulated<Model>::k_force(double d2) const {
+  double k;
+  pair(d2, k);
+  return k;
+}
+template <typename Model>
+void Tabulated<Model>::force(const double *s, size_t dim, double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < dim; i++)
+    d2 += s[i] * s[i];
+  double k = k_force(d2);
+  for (size_t i = 0; i < dim; i++)
+    F[i] = k * s[i];
+}
+template <typename Model>
+void Tabulated<Model>::force(const Particle &part1, const Particle &part2,
+                             double *F) const {
+  double d2 = 0;
+  for (size_t i = 0; i < part1.dim; i++)
+    d2 += (part1.x[i] - part2.x[i]) * (part1.x[i] - part2.x[i]);
+  double k = k_force(d2);
+  for (size_t i = 0; i < part1.dim; i++)
+    F[i] = k * (part1.x[i] - part2.x[i]);
+}
+
+// Tabulated model
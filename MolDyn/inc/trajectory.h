@@ -0,0 +1,821 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "moldyn.h"
+
+/*    Binary trajectories   */
+
+// File layout (native byte order):
+// header, container size (dim doubles), frames, frame index
+// Header, box and every frame start on a 64 byte boundary, so component rows
+// of a memory mapped file can be used in place.
+// Frame: time (double, padded to 64 bytes), position rows, velocity rows
+// (optional), each row n_particles float64 or float32.
+// Frame index: byte offset of each frame (uint64). A file whose writer did not
+// close it has no index: frames are then found from the fixed frame size.
+
+// Compressed trajectories (similar to XTC), read sequentially:
+// header, container size, then frames of
+// byte count (uint64), time (double), key flag (uint8), packed positions.
+// Positions are quantized to multiples of a precision p on [0, L], so each
+// component is within p / 2 of the true value. Key frames store the quantized
+// values, the others the change since the previous frame (modulo the number
+// of levels, so a jump across a periodic boundary stays small). Values are
+// zigzag coded and bit packed in blocks of TRAJ_BLOCK, each block with the
+// width of its largest value.
+
+// Frame contents
+enum Traj_Flags : uint32_t { traj_velocities = 1, traj_single = 2 };
+
+// Fixed header
+struct Traj_Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t dim;
+  uint64_t n_particles;
+  // Time steps between recorded frames
+  uint64_t frame_stride;
+  uint64_t n_frames;
+  // Offset of the frame index (0: no index)
+  uint64_t index_offset;
+  uint64_t reserved;
+};
+
+const char TRAJ_MAGIC[8] = {'M', 'D', 'T', 'R', 'A', 'J', 0, 0};
+const uint32_t TRAJ_VERSION = 1;
+const size_t TRAJ_ALIGN = 64;
+
+// Bytes rounded up to TRAJ_ALIGN
+inline uint64_t traj_pad(uint64_t bytes) {
+  return (bytes + TRAJ_ALIGN - 1) / TRAJ_ALIGN * TRAJ_ALIGN;
+}
+
+// ID of the particle in each storage slot of a system that reorders its
+// particles (ids()), null for anything kept in ID order (frames)
+template <typename System>
+auto traj_ids(const System &sys, int) -> decltype(sys.ids().data()) {
+  return sys.ids().data();
+}
+template <typename System> const size_t *traj_ids(const System &, long) {
+  return nullptr;
+}
+
+/*    Trajectory writer   */
+
+class Trajectory_Writer {
+
+  std::FILE *_file;
+  Traj_Header _header;
+  // Frame index
+  std::vector<uint64_t> _index;
+  // Offset of the next frame
+  uint64_t _offset;
+  // Calls to record so far
+  uint64_t _steps;
+  // Conversion buffer for single precision rows, and for double rows of
+  // single precision systems or systems that reorder their particles (both
+  // reused)
+  std::vector<float> _row;
+  std::vector<double> _row_d;
+  // File buffer
+  std::vector<char> _buffer;
+
+  // Write bytes and zero padding up to the next boundary
+  void _write(const void *, size_t);
+  template <typename Real> void _write_row(const Real *, const size_t *);
+
+public:
+  // Constructor
+  // IN: file name, number of dimensions, number of particles, container
+  // size (dim values), frame stride, store velocities, store float32
+  Trajectory_Writer(const std::string &, size_t, size_t, const double *,
+                    size_t = 1, bool = false, bool = false);
+  // Writes the frame index
+  ~Trajectory_Writer(void);
+
+  Trajectory_Writer(const Trajectory_Writer &) = delete;
+  Trajectory_Writer &operator=(const Trajectory_Writer &) = delete;
+
+  // Getters
+  size_t n_frames(void) const { return _index.size(); }
+  size_t frame_stride(void) const { return _header.frame_stride; }
+
+  // Record a time step: a frame is written every frame_stride calls,
+  // starting with the first one; particles are written in ID order
+  // IN: particles (any precision), time, ID of the particle in each slot
+  // (null: slots are in ID order)
+  template <typename Real>
+  void record(const Basic_Particle_Array<Real> &, double,
+              const size_t * = nullptr);
+  // Same, from a system or a frame
+  template <typename System> void record(System &);
+  // Write the frame index and close the file
+  void close(void);
+};
+
+// Trajectory writer
+
+/*    Trajectory reader   */
+
+class Trajectory_Reader {
+
+  // Mapped file
+  const char *_data;
+  size_t _length;
+  Traj_Header _header;
+  // Container size
+  const double *_box;
+  // Frame offsets
+  std::vector<uint64_t> _index;
+  // Bytes of a component row
+  size_t _row_bytes;
+
+  // Start of a component row
+  const char *_row(size_t, size_t) const;
+
+public:
+  // Constructor
+  // IN: file name
+  Trajectory_Reader(const std::string &);
+  ~Trajectory_Reader(void);
+
+  Trajectory_Reader(const Trajectory_Reader &) = delete;
+  Trajectory_Reader &operator=(const Trajectory_Reader &) = delete;
+
+  // Getters
+  bool valid(void) const { return _data != nullptr; }
+  size_t dim(void) const { return _header.dim; }
+  size_t n_particles(void) const { return _header.n_particles; }
+  size_t n_frames(void) const { return _index.size(); }
+  size_t frame_stride(void) const { return _header.frame_stride; }
+  bool velocities(void) const { return _header.flags & traj_velocities; }
+  bool single(void) const { return _header.flags & traj_single; }
+  // Container size
+  double size(size_t i) const { return _box[i]; }
+
+  // Time of a frame (NaN on a bad query)
+  double time(size_t) const;
+  // Component rows of a frame, in place in the mapping
+  // Real must match the stored precision (float with traj_single)
+  template <typename Real> const Real *x(size_t, size_t) const;
+  template <typename Real> const Real *v(size_t, size_t) const;
+  // Single component of particle j in frame f, in double precision (NaN
+  // on a bad query)
+  double x(size_t, size_t, size_t) const;
+  double v(size_t, size_t, size_t) const;
+};
+
+// Trajectory reader
+
+/*    Trajectory writer   */
+
+// Constructor
+Trajectory_Writer::Trajectory_Writer(const std::string &name, size_t dim,
+                                     size_t n_particles, const double *box,
+                                     size_t frame_stride, bool velocities,
+                                     bool single)
+    : _file(nullptr), _header(), _offset(0), _steps(0),
+      _row(single ? n_particles : 0), _buffer(1 << 20) {
+
+  std::memcpy(_header.magic, TRAJ_MAGIC, sizeof(TRAJ_MAGIC));
+  _header.version = TRAJ_VERSION;
+  if (velocities)
+    _header.flags |= traj_velocities;
+  if (single)
+    _header.flags |= traj_single;
+  _header.dim = dim;
+  _header.n_particles = n_particles;
+  _header.frame_stride = frame_stride ? frame_stride : 1;
+
+  try {
+    _file = std::fopen(name.c_str(), "wb");
+    if (!_file)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot open " << name << '\n';
+    return;
+  }
+  std::setvbuf(_file, _buffer.data(), _IOFBF, _buffer.size());
+
+  // Header (index offset written on close) and container size
+  _write(&_header, sizeof(_header));
+  _write(box, dim * sizeof(double));
+}
+
+// Writes the frame index
+Trajectory_Writer::~Trajectory_Writer(void) { close(); }
+
+// Write bytes and zero padding up to the next boundary
+void Trajectory_Writer::_write(const void *bytes, size_t n) {
+  static const char zeros[TRAJ_ALIGN] = {};
+  std::fwrite(bytes, 1, n, _file);
+  std::fwrite(zeros, 1, traj_pad(n) - n, _file);
+  _offset += traj_pad(n);
+}
+
+// Write a component row in the stored precision, in ID order
+template <typename Real>
+void Trajectory_Writer::_write_row(const Real *row, const size_t *ids) {
+  size_t j;
+  const size_t n = _header.n_particles;
+  if (_header.flags & traj_single) {
+    for (j = 0; j < n; j++)
+      _row[ids ? ids[j] : j] = float(row[j]);
+    _write(_row.data(), n * sizeof(float));
+  } else if (ids || !std::is_same<Real, double>::value) {
+    _row_d.resize(n);
+    for (j = 0; j < n; j++)
+      _row_d[ids ? ids[j] : j] = double(row[j]);
+    _write(_row_d.data(), n * sizeof(double));
+  } else
+    _write(row, n * sizeof(double));
+}
+
+// Record a time step
+template <typename Real>
+void Trajectory_Writer::record(const Basic_Particle_Array<Real> &particles,
+                               double time, const size_t *ids) {
+  size_t i;
+  if (!_file)
+    return;
+  if (_steps++ % _header.frame_stride)
+    return;
+  _index.push_back(_offset);
+  _write(&time, sizeof(time));
+  for (i = 0; i < _header.dim; i++)
+    _write_row(particles.x(i), ids);
+  if (_header.flags & traj_velocities)
+    for (i = 0; i < _header.dim; i++)
+      _write_row(particles.v(i), ids);
+}
+
+// Record a time step from a system
+template <typename System> void Trajectory_Writer::record(System &sys) {
+  record(sys.particles(), sys.time(), traj_ids(sys, 0));
+}
+
+// Write the frame index and close the file
+void Trajectory_Writer::close(void) {
+  if (!_file)
+    return;
+  _header.n_frames = _index.size();
+  _header.index_offset = _offset;
+  std::fwrite(_index.data(), sizeof(uint64_t), _index.size(), _file);
+  std::fseek(_file, 0, SEEK_SET);
+  std::fwrite(&_header, sizeof(_header), 1, _file);
+  std::fclose(_file);
+  _file = nullptr;
+}
+
+// Trajectory writer
+
+/*    Trajectory reader   */
+
+// Constructor
+Trajectory_Reader::Trajectory_Reader(const std::string &name)
+    : _data(nullptr), _length(0), _header(), _box(nullptr), _row_bytes(0) {
+
+  int fd = -1;
+  try {
+    fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Traj_Header))
+      throw 0;
+    _length = st.st_size;
+    void *map = mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      throw 0;
+    _data = static_cast<const char *>(map);
+    std::memcpy(&_header, _data, sizeof(_header));
+    if (std::memcmp(_header.magic, TRAJ_MAGIC, sizeof(TRAJ_MAGIC)) != 0 ||
+        _header.version != TRAJ_VERSION)
+      throw 0;
+
+    // Sizes from the header must fit in the file before anything is read
+    // through them
+    if (_header.dim == 0 || _header.dim > _length / sizeof(double) ||
+        _header.n_particles > _length / sizeof(float))
+      throw 0;
+    const size_t first =
+        sizeof(Traj_Header) + traj_pad(dim() * sizeof(double));
+    if (first > _length)
+      throw 0;
+    _box = reinterpret_cast<const double *>(_data + sizeof(Traj_Header));
+    _row_bytes = traj_pad(_header.n_particles *
+                          (single() ? sizeof(float) : sizeof(double)));
+    const size_t frame =
+        TRAJ_ALIGN + (velocities() ? 2 : 1) * dim() * _row_bytes;
+
+    // Frame index, rebuilt from the frame size if the file was not closed
+    if (_header.index_offset) {
+      if (_header.index_offset < first || _header.index_offset > _length ||
+          _header.n_frames >
+              (_length - _header.index_offset) / sizeof(uint64_t))
+        throw 0;
+      _index.resize(_header.n_frames);
+      std::memcpy(_index.data(), _data + _header.index_offset,
+                  _header.n_frames * sizeof(uint64_t));
+      for (const uint64_t offset : _index)
+        if (offset < first || offset > _length || frame > _length - offset)
+          throw 0;
+    } else
+      for (size_t offset = first; offset + frame <= _length; offset += frame)
+        _index.push_back(offset);
+  } catch (...) {
+    std::cerr << "Error: cannot read trajectory " << name << '\n';
+    if (_data)
+      munmap(const_cast<char *>(_data), _length);
+    _data = nullptr;
+    _box = nullptr;
+    _index.clear();
+    _header.dim = _header.n_particles = 0;
+    if (fd >= 0)
+      ::close(fd);
+    return;
+  }
+  ::close(fd);
+}
+
+Trajectory_Reader::~Trajectory_Reader(void) {
+  if (_data)
+    munmap(const_cast<char *>(_data), _length);
+}
+
+// Start of component row r (positions, then velocities) of frame f
+const char *Trajectory_Reader::_row(size_t f, size_t r) const {
+  return _data + _index[f] + TRAJ_ALIGN + r * _row_bytes;
+}
+
+// Time of a frame
+double Trajectory_Reader::time(size_t f) const {
+  try {
+    if (f >= n_frames())
+      throw 0;
+    double t;
+    std::memcpy(&t, _data + _index[f], sizeof(t));
+    return t;
+  } catch (...) {
+    std::cerr << "Error: invalid query" << '\n';
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+}
+
+// Position row i of frame f
+template <typename Real>
+const Real *Trajectory_Reader::x(size_t f, size_t i) const {
+  try {
+    if (single() != std::is_same<Real, float>::value || f >= n_frames() ||
+        i >= dim())
+      throw 0;
+    return reinterpret_cast<const Real *>(_row(f, i));
+  } catch (...) {
+    std::cerr << "Error: invalid query" << '\n';
+    return nullptr;
+  }
+}
+
+// Velocity row i of frame f
+template <typename Real>
+const Real *Trajectory_Reader::v(size_t f, size_t i) const {
+  try {
+    if (single() != std::is_same<Real, float>::value || f >= n_frames() ||
+        i >= dim() || !velocities())
+      throw 0;
+    return reinterpret_cast<const Real *>(_row(f, dim() + i));
+  } catch (...) {
+    std::cerr << "Error: invalid query" << '\n';
+    return nullptr;
+  }
+}
+
+// Position component i of particle j in frame f (NaN on a bad query)
+double Trajectory_Reader::x(size_t f, size_t j, size_t i) const {
+  try {
+    if (f >= n_frames() || j >= n_particles() || i >= dim())
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: invalid query" << '\n';
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (single())
+    return x<float>(f, i)[j];
+  return x<double>(f, i)[j];
+}
+
+// Velocity component i of particle j in frame f (NaN on a bad query)
+double Trajectory_Reader::v(size_t f, size_t j, size_t i) const {
+  try {
+    if (f >= n_frames() || j >= n_particles() || i >= dim() || !velocities())
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: invalid query" << '\n';
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  if (single())
+    return v<float>(f, i)[j];
+  return v<double>(f, i)[j];
+}
+
+// Trajectory reader
+
+/*    Bit packing   */
+
+// Bits appended to a byte buffer, least significant first
+class Bit_Writer {
+  std::vector<uint8_t> &_out;
+  uint64_t _acc;
+  unsigned _n;
+
+public:
+  Bit_Writer(std::vector<uint8_t> &out) : _out(out), _acc(0), _n(0) {}
+  // Append the lowest bits (at most 56) of a value
+  void put(uint64_t value, unsigned bits) {
+    _acc |= value << _n;
+    _n += bits;
+    while (_n >= 8) {
+      _out.push_back(uint8_t(_acc));
+      _acc >>= 8;
+      _n -= 8;
+    }
+  }
+  // Complete the last byte
+  void flush(void) {
+    if (_n)
+      _out.push_back(uint8_t(_acc));
+    _acc = _n = 0;
+  }
+};
+
+// Bits read from a byte buffer, least significant first; past its end
+// zeros are read and the reader is marked short
+class Bit_Reader {
+  const uint8_t *_in, *_end;
+  uint64_t _acc;
+  unsigned _n;
+  bool _short;
+
+public:
+  Bit_Reader(const uint8_t *in, const uint8_t *end)
+      : _in(in), _end(end), _acc(0), _n(0), _short(false) {}
+  // Whether more bits were asked for than the buffer holds
+  bool short_read(void) const { return _short; }
+  // Read a value of at most 56 bits
+  uint64_t get(unsigned bits) {
+    while (_n < bits) {
+      if (_in < _end)
+        _acc |= uint64_t(*_in++) << _n;
+      else
+        _short = true;
+      _n += 8;
+    }
+    uint64_t value = bits ? _acc & (~uint64_t(0) >> (64 - bits)) : 0;
+    _acc >>= bits;
+    _n -= bits;
+    return value;
+  }
+};
+
+// Values per bit packed block
+const size_t TRAJ_BLOCK = 32;
+// Widest packed value
+const unsigned TRAJ_MAX_WIDTH = 56;
+
+// Signed to unsigned: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+inline uint64_t zigzag(int64_t d) { return (uint64_t(d) << 1) ^ uint64_t(d >> 63); }
+inline int64_t unzigzag(uint64_t u) { return int64_t(u >> 1) ^ -int64_t(u & 1); }
+
+// Bit packing
+
+/*    Compressed trajectory writer   */
+
+class Compressed_Writer {
+
+  std::FILE *_file;
+  size_t _dim;
+  size_t _n_particles;
+  size_t _frame_stride;
+  // Frames between key frames
+  size_t _key_interval;
+  double _precision;
+  // Quantization levels per dimension
+  std::vector<int64_t> _levels;
+  // Calls to record and frames written so far
+  size_t _steps, _frames;
+  // Quantized positions of the last frame and of the current one
+  std::vector<int64_t> _q_last, _q;
+  // Encoded frame
+  std::vector<uint8_t> _bytes;
+  std::vector<uint64_t> _codes;
+
+public:
+  // Constructor
+  // IN: file name, number of dimensions, number of particles, container
+  // size (dim values), precision, frame stride, frames between key frames
+  Compressed_Writer(const std::string &, size_t, size_t, const double *,
+                    double, size_t = 1, size_t = 100);
+  ~Compressed_Writer(void);
+
+  Compressed_Writer(const Compressed_Writer &) = delete;
+  Compressed_Writer &operator=(const Compressed_Writer &) = delete;
+
+  // Getters
+  size_t n_frames(void) const { return _frames; }
+  double precision(void) const { return _precision; }
+
+  // Record a time step: a frame is written every frame_stride calls,
+  // starting with the first one; particles are written in ID order
+  // IN: particles (any precision), time, ID of the particle in each slot
+  // (null: slots are in ID order)
+  template <typename Real>
+  void record(const Basic_Particle_Array<Real> &, double,
+              const size_t * = nullptr);
+  // Same, from a system or a frame
+  template <typename System> void record(System &);
+  // Close the file
+  void close(void);
+};
+
+// Compressed trajectory writer
+
+/*    Compressed trajectory reader   */
+
+class Compressed_Reader {
+
+  std::FILE *_file;
+  size_t _dim;
+  size_t _n_particles;
+  size_t _frame_stride;
+  double _precision;
+  std::vector<double> _box;
+  std::vector<int64_t> _levels;
+  // Quantized positions of the last frame read
+  std::vector<int64_t> _q;
+  // Encoded frame, and the most bytes a frame can take
+  std::vector<uint8_t> _bytes;
+  uint64_t _max_count;
+
+public:
+  // Constructor
+  // IN: file name
+  Compressed_Reader(const std::string &);
+  ~Compressed_Reader(void);
+
+  Compressed_Reader(const Compressed_Reader &) = delete;
+  Compressed_Reader &operator=(const Compressed_Reader &) = delete;
+
+  // Getters
+  bool valid(void) const { return _file != nullptr; }
+  size_t dim(void) const { return _dim; }
+  size_t n_particles(void) const { return _n_particles; }
+  size_t frame_stride(void) const { return _frame_stride; }
+  double precision(void) const { return _precision; }
+  // Container size
+  double size(size_t i) const { return _box[i]; }
+
+  // Read the next frame: time and position rows (dim rows of n_particles)
+  // OUT: false at the end of the file or on a short or corrupt frame
+  bool next(double &, std::vector<double> &);
+};
+
+// Compressed trajectory reader
+
+/*    Compressed trajectory writer   */
+
+const char TRAJ_XTC_MAGIC[8] = {'M', 'D', 'X', 'T', 'C', 0, 0, 0};
+
+// Constructor
+Compressed_Writer::Compressed_Writer(const std::string &name, size_t dim,
+                                     size_t n_particles, const double *box,
+                                     double precision, size_t frame_stride,
+                                     size_t key_interval)
+    : _file(nullptr), _dim(dim), _n_particles(n_particles),
+      _frame_stride(frame_stride ? frame_stride : 1),
+      _key_interval(key_interval ? key_interval : 1), _precision(precision),
+      _levels(dim), _steps(0), _frames(0), _q_last(dim * n_particles),
+      _q(dim * n_particles), _codes(TRAJ_BLOCK) {
+
+  try {
+    if (!(precision > 0))
+      throw 0;
+    _file = std::fopen(name.c_str(), "wb");
+    if (!_file)
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot open " << name << '\n';
+    return;
+  }
+
+  for (size_t i = 0; i < _dim; i++)
+    _levels[i] = int64_t(std::ceil(box[i] / _precision)) + 1;
+
+  // Header
+  const uint64_t header[4] = {uint64_t(_dim), uint64_t(_n_particles),
+                              uint64_t(_frame_stride), uint64_t(_key_interval)};
+  std::fwrite(TRAJ_XTC_MAGIC, 1, sizeof(TRAJ_XTC_MAGIC), _file);
+  std::fwrite(&TRAJ_VERSION, sizeof(TRAJ_VERSION), 1, _file);
+  std::fwrite(header, sizeof(uint64_t), 4, _file);
+  std::fwrite(&_precision, sizeof(double), 1, _file);
+  std::fwrite(box, sizeof(double), _dim, _file);
+}
+
+Compressed_Writer::~Compressed_Writer(void) { close(); }
+
+// Record a time step
+template <typename Real>
+void Compressed_Writer::record(const Basic_Particle_Array<Real> &particles,
+                               double time, const size_t *ids) {
+  size_t i, j, b;
+  if (!_file)
+    return;
+  if (_steps++ % _frame_stride)
+    return;
+
+  const bool key = _frames % _key_interval == 0;
+  const size_t n = _n_particles;
+  _bytes.clear();
+  Bit_Writer bits(_bytes);
+
+  for (i = 0; i < _dim; i++) {
+    const Real *x = particles.x(i);
+    const int64_t M = _levels[i];
+    int64_t *q = _q.data() + i * n, *q_last = _q_last.data() + i * n;
+    // Quantize, in ID order
+    for (j = 0; j < n; j++) {
+      int64_t l = std::llround(double(x[j]) / _precision);
+      q[ids ? ids[j] : j] = l < 0 ? 0 : (l >= M ? M - 1 : l);
+    }
+    // Pack blocks: quantized values or changes folded to (-M/2, M/2]
+    for (b = 0; b < n; b += TRAJ_BLOCK) {
+      const size_t m = std::min(TRAJ_BLOCK, n - b);
+      uint64_t all = 0;
+      for (j = 0; j < m; j++) {
+        int64_t d = q[b + j];
+        if (!key) {
+          d -= q_last[b + j];
+          if (d > M / 2)
+            d -= M;
+          else if (d < -(M - 1) / 2)
+            d += M;
+        }
+        _codes[j] = key ? uint64_t(d) : zigzag(d);
+        all |= _codes[j];
+      }
+      unsigned width = 0;
+      while (all >> width)
+        width++;
+      bits.put(width, 6);
+      for (j = 0; j < m; j++)
+        bits.put(_codes[j], width);
+    }
+  }
+  bits.flush();
+  _q_last.swap(_q);
+
+  // Frame: byte count, time, key flag, packed positions
+  const uint64_t count = _bytes.size();
+  const uint8_t key_flag = key;
+  std::fwrite(&count, sizeof(count), 1, _file);
+  std::fwrite(&time, sizeof(time), 1, _file);
+  std::fwrite(&key_flag, 1, 1, _file);
+  std::fwrite(_bytes.data(), 1, count, _file);
+  _frames++;
+}
+
+// Record a time step from a system
+template <typename System> void Compressed_Writer::record(System &sys) {
+  record(sys.particles(), sys.time(), traj_ids(sys, 0));
+}
+
+// Close the file
+void Compressed_Writer::close(void) {
+  if (!_file)
+    return;
+  std::fclose(_file);
+  _file = nullptr;
+}
+
+// Compressed trajectory writer
+
+/*    Compressed trajectory reader   */
+
+// Constructor
+Compressed_Reader::Compressed_Reader(const std::string &name)
+    : _file(nullptr), _dim(0), _n_particles(0), _frame_stride(0),
+      _precision(0), _max_count(0) {
+
+  char magic[8];
+  uint32_t version;
+  uint64_t header[4];
+  try {
+    _file = std::fopen(name.c_str(), "rb");
+    struct stat st;
+    if (!_file || fstat(fileno(_file), &st) != 0)
+      throw 0;
+    const uint64_t length = st.st_size;
+    if (std::fread(magic, 1, sizeof(magic), _file) != sizeof(magic) ||
+        std::memcmp(magic, TRAJ_XTC_MAGIC, sizeof(magic)) != 0 ||
+        std::fread(&version, sizeof(version), 1, _file) != 1 ||
+        version != TRAJ_VERSION ||
+        std::fread(header, sizeof(uint64_t), 4, _file) != 4 ||
+        std::fread(&_precision, sizeof(double), 1, _file) != 1)
+      throw 0;
+    // Sizes from the header must fit in the file before anything is
+    // allocated for them: the box, and a key frame packs at least 6 bits
+    // per block of each dimension
+    const uint64_t dim = header[0], n = header[1];
+    if (dim == 0 || dim > length / sizeof(double) ||
+        n / TRAJ_BLOCK > 8 * length / (6 * dim) ||
+        !(_precision > 0) || !std::isfinite(_precision))
+      throw 0;
+    _box.resize(dim);
+    if (std::fread(_box.data(), sizeof(double), dim, _file) != dim)
+      throw 0;
+    _levels.resize(dim);
+    for (size_t i = 0; i < dim; i++) {
+      const double levels = std::ceil(_box[i] / _precision) + 1;
+      if (!(levels >= 1 && levels < double(uint64_t(1) << TRAJ_MAX_WIDTH)))
+        throw 0;
+      _levels[i] = int64_t(levels);
+    }
+    _q.resize(dim * n);
+    _dim = dim;
+    _n_particles = n;
+    _frame_stride = header[2];
+    // A width and n values of the widest code per block, per dimension
+    const uint64_t blocks = (n + TRAJ_BLOCK - 1) / TRAJ_BLOCK;
+    _max_count = (dim * (6 * blocks + TRAJ_MAX_WIDTH * n) + 7) / 8;
+  } catch (...) {
+    std::cerr << "Error: cannot read trajectory " << name << '\n';
+    if (_file)
+      std::fclose(_file);
+    _file = nullptr;
+    _dim = _n_particles = 0;
+    return;
+  }
+}
+
+Compressed_Reader::~Compressed_Reader(void) {
+  if (_file)
+    std::fclose(_file);
+}
+
+// Read the next frame
+bool Compressed_Reader::next(double &time, std::vector<double> &x) {
+  size_t i, j, b;
+  uint64_t count;
+  uint8_t key;
+  if (!_file)
+    return false;
+  if (std::fread(&count, sizeof(count), 1, _file) != 1 ||
+      std::fread(&time, sizeof(time), 1, _file) != 1 ||
+      std::fread(&key, 1, 1, _file) != 1 || count > _max_count)
+    return false;
+  _bytes.resize(count);
+  if (std::fread(_bytes.data(), 1, count, _file) != count)
+    return false;
+
+  const size_t n = _n_particles;
+  Bit_Reader bits(_bytes.data(), _bytes.data() + count);
+  x.resize(_dim * n);
+  for (i = 0; i < _dim; i++) {
+    const int64_t M = _levels[i];
+    int64_t *q = _q.data() + i * n;
+    for (b = 0; b < n; b += TRAJ_BLOCK) {
+      const size_t m = std::min(TRAJ_BLOCK, n - b);
+      const unsigned width = bits.get(6);
+      if (width > TRAJ_MAX_WIDTH || bits.short_read())
+        return false;
+      for (j = 0; j < m; j++) {
+        const uint64_t code = bits.get(width);
+        if (key)
+          q[b + j] = int64_t(code);
+        else {
+          int64_t l = q[b + j] + unzigzag(code);
+          q[b + j] = l < 0 ? l + M : (l >= M ? l - M : l);
+        }
+      }
+    }
+    if (bits.short_read())
+      return false;
+    for (j = 0; j < n; j++)
+      x[i * n + j] = q[j] * _precision;
+  }
+  return true;
+}
+
+// Compressed trajectory reader
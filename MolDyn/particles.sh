@@ -5,8 +5,13 @@ clear
 
 rm -f particles.dat
 
-icpc -S -I ./inc ./src/particles.cpp > ./asm/particles.s
+icpc -std=c++17 -qopenmp -S -I ./inc ./src/particles.cpp > ./asm/particles.s
 
-icpc -Wall -O3 -I ./inc ./src/particles.cpp -o ./bin/particles
+icpc -std=c++17 -qopenmp -Wall -O3 -I ./inc ./src/particles.cpp -o ./bin/particles
 
-./bin/particles | gnuplot -p
+icpc -std=c++17 -Wall -O3 -I ./inc ./src/viewer.cpp -o ./bin/viewer
+
+# Simulation publishes to shared memory, the viewer drives gnuplot
+./bin/particles &
+./bin/viewer /moldyn | gnuplot -p
+kill %1
@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+
+clear
+clear
+
+mpiicpc -std=c++17 -qopenmp -Wall -O3 -I ./inc ./src/particles_mpi.cpp -o ./bin/particles_mpi
+
+# One subdomain per rank
+mpirun -np 4 ./bin/particles_mpi
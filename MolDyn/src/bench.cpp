@@ -0,0 +1,139 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+// Allocations: every operator new of the process is counted
+#define MOLDYN_COUNT_ALLOCS
+#include "moldyn.h"
+
+// Benchmarks of NewtonSys: construction, vverlet, kinetic and potential
+// over number of particles, dimensions, boundaries, models and precisions
+// (Lennard-Jones only), with the energy drift of the timed steps.
+// JSON results to stdout, progress to stderr.
+// Usage: bench [max particles (default 1e5)] [seconds per case (0.5)]
+// Systems are seeded with MOLDYN_SEED (set to 12345 unless given).
+
+// Seconds taken by f
+double seconds(const std::function<void(void)> &f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+// One case: construction, then steps for about the time given
+template <typename Model, size_t Dim, typename Precision = Double_Precision>
+void bench(const Model &model, Bound bound, size_t n, double budget,
+           bool &first) {
+
+  // Dummy index
+  size_t s;
+
+  const double dt = 0.002, T_0 = 1 / K_B, rho = 0.8;
+  const Lattice lattice = Dim == 2 ? lattice_hex : lattice_fcc;
+
+  typedef NewtonSys<Model, Dim, Precision> System;
+  System *sys = nullptr;
+  const double t_construct = seconds([&] {
+    sys = new System(Dim, n, 1, T_0, rho, bound, model, lattice, 0.05);
+  });
+
+  // Warm up (first neighbour list, buffers), then double the number of
+  // steps until the budget is used
+  sys->vverlet(dt);
+  const double E_0 = sys->kinetic() + sys->potential();
+  size_t steps = 1, done = 0, allocs = 0;
+  double t_steps = 0;
+  while (t_steps < budget) {
+    const size_t before = n_allocs.load();
+    t_steps += seconds([&] {
+      for (s = 0; s < steps; s++)
+        sys->vverlet(dt);
+    });
+    allocs += n_allocs.load() - before;
+    done += steps;
+    steps *= 2;
+  }
+  // Energy drift per particle and unit time
+  const double drift =
+      (sys->kinetic() + sys->potential() - E_0) / (n * done * dt);
+
+  // Getters, then full evaluations of the potential (the getter returns
+  // the value cached by the last step)
+  const size_t calls = 1000, evals = 10;
+  volatile double sink = 0;
+  const double t_kinetic = seconds([&] {
+    for (s = 0; s < calls; s++)
+      sink = sink + sys->kinetic();
+  });
+  const double t_potential_get = seconds([&] {
+    for (s = 0; s < calls; s++)
+      sink = sink + sys->potential();
+  });
+  const double t_potential = seconds([&] {
+    for (s = 0; s < evals; s++) {
+      sys->evaluate();
+      sink = sink + sys->potential();
+    }
+  });
+
+  const double t_step = t_steps / done;
+  const size_t pairs = sys->n_pairs();
+  std::printf("%s    {\"model\": \"%s\", \"precision\": \"%s\", "
+              "\"dim\": %zu, \"bound\": \"%s\", "
+              "\"n\": %zu, \"construct_s\": %.6e, \"steps\": %zu, "
+              "\"step_s\": %.6e, \"steps_per_s\": %.6e, \"pairs\": %zu, "
+              "\"ns_per_pair\": ",
+              first ? "" : ",\n", Model::name.c_str(), Precision::name, Dim,
+              bound == periodic ? "periodic" : "walls", n, t_construct, done,
+              t_step, 1 / t_step, pairs);
+  if (pairs)
+    std::printf("%.4f", 1e9 * t_step / pairs);
+  else
+    std::printf("null");
+  std::printf(", \"kinetic_ns\": %.2f, \"potential_get_ns\": %.2f, "
+              "\"potential_eval_s\": %.6e, \"allocs_per_step\": %.3f, "
+              "\"rebuilds\": %zu, \"drift\": %.3e}",
+              1e9 * t_kinetic / calls, 1e9 * t_potential_get / calls,
+              t_potential / evals, double(allocs) / done, sys->n_rebuilds(),
+              drift);
+  std::fflush(stdout);
+  first = false;
+
+  std::cerr << Model::name << ' ' << Precision::name << ' ' << Dim << "D "
+            << (bound == periodic ? "periodic" : "walls") << " N = " << n
+            << ": " << 1 / t_step << " steps/s" << '\n';
+  delete sys;
+}
+
+int main(int argc, char **argv) {
+
+  const size_t max_n = argc > 1 ? size_t(std::atof(argv[1])) : 100000;
+  const double budget = argc > 2 ? std::atof(argv[2]) : 0.5;
+  setenv("MOLDYN_SEED", "12345", 0);
+
+  const char *simd[] = {"scalar", "avx2", "avx512"};
+  std::printf("{\n  \"compiler\": \"%s\",\n  \"threads\": %d,\n"
+              "  \"simd\": \"%s\",\n  \"seed\": %s,\n  \"results\": [\n",
+              __VERSION__, max_threads(), simd[simd_level()],
+              std::getenv("MOLDYN_SEED"));
+
+  bool first = true;
+  for (size_t n = 100; n <= max_n; n *= 10)
+    for (Bound bound : {walls, periodic}) {
+      bench<Ideal_Gas, 2>(Ideal_Gas(), bound, n, budget, first);
+      bench<Ideal_Gas, 3>(Ideal_Gas(), bound, n, budget, first);
+      bench<Lennard_Jones, 2>(Lennard_Jones(), bound, n, budget, first);
+      bench<Lennard_Jones, 3>(Lennard_Jones(), bound, n, budget, first);
+      bench<Lennard_Jones, 3, Mixed_Precision>(Lennard_Jones(), bound, n,
+                                               budget, first);
+      bench<Lennard_Jones, 3, Float_Precision>(Lennard_Jones(), bound, n,
+                                               budget, first);
+    }
+  std::printf("\n  ]\n}\n");
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <fstream>
+
+#include "ensemble.h"
+
+// Replica ensemble: independent Lennard-Jones systems over a range of
+// initial temperatures, several seeds each, run in one process.
+// Output: one line per replica and record, "replica seed T_0 time E P"
+
+int main() {
+
+  // Dummy indices
+  size_t i, k;
+
+  // Reduced units
+  const size_t dim = 2, n_particles = 100;
+  const size_t n_T = 16, n_seeds = 8;
+  const double rho = 0.6, dt = 0.002;
+  typedef NewtonSys<Lennard_Jones, dim> System;
+
+  // Replicas are built on the workers
+  Ensemble<System> ensemble([&](unsigned seed, double T_0) {
+    return new System(dim, n_particles, 1, T_0 / K_B, rho, periodic,
+                      Lennard_Jones(1, 1), lattice_hex, 0.05, 0, seed);
+  });
+
+  // T_0 from 0.5 to 2
+  for (i = 0; i < n_T; i++)
+    for (k = 0; k < n_seeds; k++)
+      ensemble.add(0.5 + 1.5 * i / (n_T - 1));
+
+  // Shared output
+  std::ofstream out("ensemble.dat");
+  ensemble.set_sink(
+      [&](size_t r, System &sys) {
+        out << r << '\t' << ensemble.seed(r) << '\t' << ensemble.T_init(r)
+            << '\t' << sys.time() << '\t' << sys.kinetic() + sys.potential()
+            << '\t' << sys.pressure() << '\n';
+      },
+      1000);
+
+  std::cerr << ensemble.n_replicas() << " replicas on "
+            << ensemble.n_workers() << " threads" << '\n';
+
+  for (i = 0; i < 10; i++) {
+    ensemble.run(1000, dt);
+    std::cerr << "Time = " << ensemble.replica(0)->time()
+              << "\tsteals = " << ensemble.n_steals() << '\n';
+  }
+}
@@ -1,4 +1,8 @@
 #include "moldyn.h"
+#include "observables.h"
+#include "pipeline.h"
+#include "tabulated.h"
+#include "trajectory.h"
 
 int main() {
 
@@ -22,21 +26,73 @@ int main() {
 
   // lj_test.plot_potential(100, 1, 3);
 
-  // Create system
-  NewtonSys<Lennard_Jones> mysys(dim, n_particles, mass, T_0, rho, periodic,
-                                 lj_int);
+  // Tabulated interaction (from r = 0.8 sigma), or read from a "r U F" file
+  // Tabulated<Lennard_Jones> tab_int(lj_int, 0.8 * sigma);
+  // Tabulated<> file_int("lj.table");
+
+  // Create system on a hexagonal lattice, slightly jittered (random
+  // placement overlaps at this density: lattice_random with a minimum
+  // distance, e.g. 0.9 * sigma, avoids that)
+  NewtonSys<Lennard_Jones, dim> mysys(dim, n_particles, mass, T_0, rho,
+                                      periodic, lj_int, lattice_hex, 0.05);
 
   // Set up model
   // mysys.model.set_epsilon(epsilon);
   // mysys.model.set_sigma(sigma);
 
+  // Keep particles close in space close in memory (large systems): storage
+  // reordered along a Hilbert curve every 100 steps
+  // mysys.set_reorder(100);
+
   // Debug
   mysys.debug();
 
-  while (1) {
+  // Binary trajectory, one frame every 10 steps
+  // double box[dim] = {mysys.size(0), mysys.size(1)};
+  // Trajectory_Writer traj("particles.traj", dim, n_particles, box, 10);
+  // Compressed, positions to 1e-3 sigma
+  // Compressed_Writer xtc("particles.xtc", dim, n_particles, box, 1e-3, 10);
+
+  // Live view: bin/viewer reads the frames (dropped if it falls behind)
+  Snapshot_Publisher view("/moldyn", dim, n_particles);
+  double lo[dim] = {0, 0}, hi[dim] = {mysys.size(0), mysys.size(1)};
+  view.set_view(snap_points, dim, lo, hi);
+
+  // Observables on the fly: g(r) up to 4 sigma, MSD, VACF, temperature
+  // Observables obs(dim, n_particles, periodic, 4 * sigma);
+
+  // Stages run on their own threads, on copies of the state, while the
+  // integrator goes on
+  Pipeline<NewtonSys<Lennard_Jones, dim>> pipe(mysys);
+  // Analysis
+  pipe.add_stage([&](const Pipe_Frame &f) {
+    if (f.step() % 1000 == 0)
+      std::cerr << "Time = " << f.time() << "\tE = " << f.kinetic + f.potential
+                << "\tP = " << f.pressure << '\n';
+    // obs.sample(f);
+  });
+  // Output
+  pipe.add_stage([&](const Pipe_Frame &f) {
     // Plot
-    mysys.out_gnuplot();
+    f.publish(view);
+    // Record
+    // traj.record(f);
+    // xtc.record(f);
+  });
+
+  // Checkpoint every 10 runs and when terminated (restart with
+  // mysys.restore("particles.ckpt") after creating the system)
+  Checkpointer ckpt("particles.ckpt", 10);
+
+  // Phase timings and counters every 10 s (build with -DMOLDYN_PROFILE)
+  // Profile_Dump prof("particles.prof", "particles", 10);
+
+  while (1) {
     // Update
-    mysys.vverlet(dt);
+    pipe.run(1000, dt);
+    // prof.tick(mysys);
+    // obs.write("particles.obs");
+    if (ckpt.step(mysys))
+      break;
   }
 }
@@ -0,0 +1,36 @@
+#include "domain.h"
+
+int main(int argc, char **argv) {
+
+  MPI_Init(&argc, &argv);
+
+  // Lennard-Jones units: FCC solid close to melting
+  const size_t dim = 3, n_particles = 32000;
+  double T_0 = 0.7 / K_B;
+  double rho = 0.9;
+  double dt = 0.004;
+
+  // Create system, split over the ranks
+  Domain_Sys<Lennard_Jones, dim> mysys(dim, n_particles, 1, T_0, rho,
+                                       periodic, Lennard_Jones(1, 1),
+                                       lattice_fcc, 0.02);
+
+  // Debug
+  mysys.debug();
+
+  for (size_t step = 1; step <= 10000; step++) {
+    mysys.vverlet(dt);
+    if (step % 100)
+      continue;
+    // Collective: every rank takes part
+    const double E_k = mysys.kinetic(), E_p = mysys.potential(),
+                 P = mysys.pressure();
+    if (mysys.rank() == 0)
+      std::cerr << "Time = " << mysys.time() << "\tE = " << E_k + E_p
+                << "\tP = " << P << '\n';
+  }
+
+  MPI_Finalize();
+
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "snapshot.h"
+
+// Live viewer: reads the latest snapshot from shared memory and drives
+// gnuplot through stdout, so the simulation never waits on plotting
+// Usage: viewer [shared memory name]   (default /moldyn)
+
+int main(int argc, char **argv) {
+
+  const std::string name = argc > 1 ? argv[1] : "/moldyn";
+
+  // Wait for the simulation
+  Snapshot_Reader *reader = new Snapshot_Reader(name);
+  while (!reader->valid()) {
+    delete reader;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    reader = new Snapshot_Reader(name);
+  }
+
+  const Snap_Header &view = reader->header();
+  std::vector<double> rows(view.max_dim * view.max_points);
+  double time;
+  size_t dim, n, i, j;
+  uint64_t shown = 0;
+
+  const char axis[SNAP_MAX_DIM] = {'x', 'y', 'z'};
+
+  while (!reader->closed()) {
+    if (!reader->latest(time, dim, n, rows.data())) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    shown++;
+
+    // Setup GNUPLOT (the view may change)
+    std::cout << "set key off" << '\n';
+    for (i = 0; i < view.view_dim; i++)
+      std::cout << "set " << axis[i] << "range [" << view.lo[i] << ':'
+                << view.hi[i] << ']' << '\n';
+    if (view.view_dim == 3)
+      std::cout << "set view equal xyz" << '\n';
+
+    // Call interactive terminal
+    std::cout << (dim == 3 ? "splot" : "plot") << " \"-\" "
+              << (view.style == snap_lines ? "w l" : "w p pt 7 ps 1") << '\n';
+    for (j = 0; j < n; j++) {
+      for (i = 0; i < dim; i++)
+        std::cout << rows[i * n + j] << "\t\t";
+      std::cout << '\n';
+    }
+    std::cout << 'e' << std::endl;
+
+    if (shown % 100 == 0)
+      std::cerr << "Time = " << time << "\tshown " << shown << "\tdropped "
+                << reader->dropped() << '\n';
+  }
+
+  std::cerr << "Frames shown: " << shown << ", dropped: " << reader->dropped()
+            << '\n';
+  delete reader;
+}
@@ -1,3 +1,5 @@
+#include <fstream>
+
 #include "pendulum.h"
 
 int main() {
@@ -14,11 +16,28 @@ int main() {
 
   Pendulum mypend(2, length, mass);
 
+  // Go on from the last checkpoint, if any; save every 10000 steps and when
+  // terminated
+  std::ifstream last("pendulum.ckpt");
+  if (last) {
+    last.close();
+    mypend.restore("pendulum.ckpt");
+  }
+  Checkpointer ckpt("pendulum.ckpt", 10000);
+
   mypend.debug();
 
+  // Live view: viewer reads the frames (dropped if it falls behind)
+  Snapshot_Publisher view("/pendulum", 2, 3);
+  double lo[2] = {-4, -4}, hi[2] = {4, 4};
+  view.set_view(snap_lines, 2, lo, hi);
+
   while (1) {
-    mypend.out_gnuplot(4);
+    // mypend.out_gnuplot(4);
+    mypend.publish(view);
     mypend.vverlet(dt);
+    if (ckpt.step(mypend))
+      break;
   }
 
   return 0;
@@ -4,9 +4,14 @@
 #include <iomanip>
 #include <iostream>
 #include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include "checkpoint.h"
+#include "instrument.h"
+#include "snapshot.h"
+
 // Constants
 const double PI = 3.141592653589793;
 const double A_G = 9.8;
@@ -24,6 +29,10 @@ private:
   size_t _n_links;
   std::vector<double> _length, _mass;
   std::vector<double> _theta, _omega, _alpha;
+  // Random number generator (kept in checkpoints)
+  std::mt19937 _mersenne_engine;
+  // Step counters and phase timings
+  Counters _counters;
 
 public:
   // Constructors
@@ -32,6 +41,11 @@ public:
   // Random theta and omega
   Pendulum(const size_t &, std::vector<double> &, std::vector<double> &);
 
+  // Getters
+  double time(void) const { return _time; }
+  const Counters &counters(void) const { return _counters; }
+  void reset_counters(void) { _counters.reset(); }
+
   // Update
 
   // Velocity-Verlet
@@ -42,8 +56,18 @@ public:
   // Output to gnuplot interactive terminal
   void out_gnuplot(double);
 
+  // Publish the chain to a live viewer, if a frame is due
+  void publish(Snapshot_Publisher &);
+
   // Debug
   void debug(void);
+
+  // Checkpoints
+
+  // Save the whole state to a file (atomically)
+  bool checkpoint(const std::string &);
+  // Restore a state saved by a pendulum with as many links
+  bool restore(const std::string &);
 };
 
 // Couples pendula
@@ -55,21 +79,18 @@ public:
 Pendulum::Pendulum(const size_t &n_links, std::vector<double> &length,
                    std::vector<double> &mass)
     : _dim(2), _time(0), _n_links(n_links), _length(length), _mass(mass),
-      _theta(n_links), _omega(n_links), _alpha(n_links) {
+      _theta(n_links), _omega(n_links), _alpha(n_links),
+      _mersenne_engine(std::random_device()()) {
 
   // Dummy indices
   size_t i, j, k;
 
-  // Random number generator
-  std::random_device rnd_dev;
-  std::mt19937 mersenne_engine(rnd_dev());
-
   // Generate random theta and omega
   std::normal_distribution<double> dist_theta(0, PI / 5);
   std::normal_distribution<double> dist_omega(0, PI / 25);
   for (j = 0; j < _n_links; j++) {
-    _theta[j] = dist_theta(mersenne_engine);
-    _omega[j] = dist_omega(mersenne_engine);
+    _theta[j] = dist_theta(_mersenne_engine);
+    _omega[j] = dist_omega(_mersenne_engine);
   }
 
   // Calculate alpha
@@ -85,6 +106,9 @@ void Pendulum::vverlet(double dt) {
   // Dummy indices
   size_t i, j, k;
 
+  const uint64_t allocs = PROFILING ? n_allocs.load() : 0;
+  _counters.steps++;
+
   // Temporary alpha
   std::vector<double> alpha_temp(_n_links);
 
@@ -92,15 +116,30 @@ void Pendulum::vverlet(double dt) {
   _time += dt;
 
   // Update positions
-  for (j = 0; j < _n_links; j++)
-    _theta[j] += _omega[j] * dt + 0.5 * _alpha[j] * dt * dt;
+  {
+    Phase_Timer timer(_counters, phase_drift);
+    for (j = 0; j < _n_links; j++)
+      _theta[j] += _omega[j] * dt + 0.5 * _alpha[j] * dt * dt;
+  }
 
-  // Update omega and alpha
-  for (j = 0; j < _n_links; j++) {
-    alpha_temp[j] = -A_G * std::sin(_theta[j]) / _length[j];
-    _omega[j] += 0.5 * (_alpha[j] + alpha_temp[j]) * dt;
-    _alpha[j] = alpha_temp[j];
+  // Update alpha
+  {
+    Phase_Timer timer(_counters, phase_force);
+    for (j = 0; j < _n_links; j++)
+      alpha_temp[j] = -A_G * std::sin(_theta[j]) / _length[j];
   }
+
+  // Update omega
+  {
+    Phase_Timer timer(_counters, phase_kick);
+    for (j = 0; j < _n_links; j++) {
+      _omega[j] += 0.5 * (_alpha[j] + alpha_temp[j]) * dt;
+      _alpha[j] = alpha_temp[j];
+    }
+  }
+
+  if (PROFILING)
+    _counters.allocs += n_allocs.load() - allocs;
 }
 
 // Output
@@ -114,6 +153,8 @@ void Pendulum::out_gnuplot(double range) {
   // Position variables
   double x = 0, y = 0, z = 0;
 
+  Phase_Timer timer(_counters, phase_output);
+
   // Setup GNUPLOT
   std::cout << "set key off" << std::endl;
   std::cout << "set xrange [" << -range << ':' << range << ']' << std::endl;
@@ -131,6 +172,27 @@ void Pendulum::out_gnuplot(double range) {
   std::cout << 'e' << std::endl;
 }
 
+// Publish the chain to a live viewer, if a frame is due
+void Pendulum::publish(Snapshot_Publisher &pub) {
+
+  // Dummy indices
+  size_t j;
+
+  if (!pub.due())
+    return;
+  Phase_Timer timer(_counters, phase_output);
+  double *rows = pub.begin(2, _n_links + 1);
+  if (!rows)
+    return;
+  double *x = rows, *y = rows + _n_links + 1;
+  x[0] = y[0] = 0;
+  for (j = 0; j < _n_links; j++) {
+    x[j + 1] = x[j] + _length[j] * std::sin(_theta[j]);
+    y[j + 1] = y[j] - _length[j] * std::cos(_theta[j]);
+  }
+  pub.commit(_time);
+}
+
 // Debug
 void Pendulum::debug(void) {
 
@@ -149,4 +211,59 @@ void Pendulum::debug(void) {
               << '\n';
 }
 
+// Checkpoints
+
+// Save the whole state to a file
+bool Pendulum::checkpoint(const std::string &name) {
+  const size_t bytes = _n_links * sizeof(double);
+  Ckpt_Writer w(ckpt_pendulum, _dim, _n_links);
+  w.add(_time);
+  w.add(_length.data(), bytes);
+  w.add(_mass.data(), bytes);
+  w.add(_theta.data(), bytes);
+  w.add(_omega.data(), bytes);
+  w.add(_alpha.data(), bytes);
+  std::ostringstream engine;
+  engine << _mersenne_engine;
+  w.add(engine.str());
+  return w.write(name);
+}
+
+// Restore a saved state
+// Everything is read and checked first: a bad file leaves the pendula as they
+// were
+bool Pendulum::restore(const std::string &name) {
+  const size_t bytes = _n_links * sizeof(double);
+  Ckpt_Reader r(name, ckpt_pendulum);
+  double time;
+  std::vector<double> length(_n_links), mass(_n_links), theta(_n_links),
+      omega(_n_links), alpha(_n_links);
+  std::string engine_state;
+  std::mt19937 engine;
+  try {
+    if (!r.valid() || r.header().dim != _dim || r.header().n != _n_links)
+      throw 0;
+    if (!(r.get(time) && r.get(length.data(), bytes) &&
+          r.get(mass.data(), bytes) && r.get(theta.data(), bytes) &&
+          r.get(omega.data(), bytes) && r.get(alpha.data(), bytes) &&
+          r.get(engine_state)))
+      throw 0;
+    std::istringstream in(engine_state);
+    if (!(in >> engine))
+      throw 0;
+  } catch (...) {
+    std::cerr << "Error: cannot restore " << name << " into a pendulum of "
+              << _n_links << " links" << '\n';
+    return false;
+  }
+  _time = time;
+  _length.swap(length);
+  _mass.swap(mass);
+  _theta.swap(theta);
+  _omega.swap(omega);
+  _alpha.swap(alpha);
+  _mersenne_engine = engine;
+  return true;
+}
+
 // Coupled pendula
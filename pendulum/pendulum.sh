@@ -3,6 +3,11 @@
 clear
 clear
 
-icpc -Wall -O3 ./pendulum.cpp -o ./pendulum
+icpc -std=c++17 -Wall -O3 -I ../MolDyn/inc ./pendulum.cpp -o ./pendulum
 
-./pendulum | gnuplot
+icpc -std=c++17 -Wall -O3 -I ../MolDyn/inc ../MolDyn/src/viewer.cpp -o ./viewer
+
+# Simulation publishes to shared memory, the viewer drives gnuplot
+./pendulum &
+./viewer /pendulum | gnuplot
+kill %1